@@ -1,7 +1,7 @@
 ; counter_app.asm
 ; Assemble with: nasm -f bin counter_app.asm -o counter_app.bin
 BITS 32
-org 0x1000    ; Address where the kernel loads the app
+org 0x300000  ; APP_LOAD_ADDR: fs_run copies the app here and calls it
 
 global _start
 _start:
@@ -23,10 +23,11 @@ print_counter:
     add cl, '0'
     ; Calculate VGA buffer offset: assume 80 columns per line and fixed position for demo.
     ; This example always writes to the first free cell in a static buffer area.
-    mov edi, vga_cursor
+    mov ch, 0x07     ; Light grey on black
+    mov edi, [vga_cursor]
     mov [edi], cx
     add edi, 2
-    mov vga_cursor, edi
+    mov [vga_cursor], edi
     ret
 
 section .data
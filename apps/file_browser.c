@@ -1,117 +1,257 @@
-/* file_browser.c - A simple text-based file browser for zOS */
-
-typedef enum { FILE_NODE, DIR_NODE } NodeType;
-
-typedef struct Node {
-    char name[32];           // File or directory name
-    NodeType type;
-    struct Node *parent;
-    union {
-        char content[1024];  // For files (or executable code)
-        struct {
-            struct Node *children[10];
-            int child_count;
-        } dir;
-    };
-} Node;
-
-/* 
-   These functions are provided by the zOS kernel:
-     - print_string: prints a null-terminated string to the screen.
-     - print_char: prints a single character.
-     - read_line: reads a line of text input.
-     - clear_screen: clears the screen.
-   They are available for use by applications.
-*/
-extern void print_string(const char *str);
-extern void print_char(char c);
-extern void read_line(char *buffer, int max_length);
+/* file_browser.c - A full-screen file browser for zOS.
+   Arrow keys and PgUp/PgDn move the selection, Home/End jump to the ends,
+   Enter opens a directory or views a file, Backspace goes up a level and
+   Esc or 'q' quits.
+
+   Directories are read through the kernel's DirIter: only the entries in
+   the visible window are fetched, one fs_readdir() batch per page, so the
+   cost of a redraw depends on the screen size rather than the directory
+   size. Moving the selection within the window repaints just the old and
+   new rows plus the status line. */
+
+typedef struct Node Node;
+
+typedef struct {
+    char name[32];
+    int is_dir;
+    unsigned int size;
+    Node *node;
+} DirEntry;
+
+typedef struct {
+    Node *dir;
+    int pos;
+} DirIter;
+
 extern void clear_screen(void);
+extern int getkey(void);
+extern void console_write_row(int row, const char *text, int len, unsigned char attr);
+extern void console_set_cursor(int row, int col);
+extern void console_flush(void);
+extern Node *fs_cwd(void);
+extern Node *fs_parent(Node *node);
+extern const char *fs_name(Node *node);
+extern int fs_opendir(Node *dir, DirIter *it);
+extern int fs_dir_count(DirIter *it);
+extern void fs_seekdir(DirIter *it, int pos);
+extern int fs_readdir(DirIter *it, DirEntry *out, int max);
+extern unsigned int fs_file_read(Node *file, unsigned int off, void *buf, unsigned int len);
 
-/* The global file system pointer from the kernel.
-   (This points to the current directory in the OS file system.)
-*/
-extern Node *current_dir;
+#define KEY_UP    0x100
+#define KEY_DOWN  0x101
+#define KEY_HOME  0x104
+#define KEY_END   0x105
+#define KEY_PGUP  0x106
+#define KEY_PGDN  0x107
+#define KEY_ESC   27
 
-/* A simple implementation of atoi (string-to-integer conversion) */
-int simple_atoi(const char *s) {
-    int num = 0;
-    while (*s) {
-        if (*s < '0' || *s > '9')
-            break;
-        num = num * 10 + (*s - '0');
-        s++;
+#define SCREEN_COLS 80
+#define LIST_TOP    1           // row 0 is the header
+#define LIST_ROWS   23          // rows 1-23; row 24 is the status line
+#define STATUS_ROW  24
+#define VIEW_ROWS   24
+
+#define ATTR_NORMAL 0x07
+#define ATTR_DIR    0x0B
+#define ATTR_SELECT 0x70
+#define ATTR_BAR    0x1F
+
+static DirIter iter;
+static int entry_count = 0;
+static int top = 0;                     // index of the first visible entry
+static int sel = 0;                     // index of the selected entry
+static DirEntry window[LIST_ROWS];      // entries top .. top + window_count - 1
+static int window_count = 0;
+
+static int append_str(char *out, int n, const char *s) {
+    while (*s && n < SCREEN_COLS)
+        out[n++] = *s++;
+    return n;
+}
+
+static int append_uint(char *out, int n, unsigned int v) {
+    char digits[10];
+    int d = 0;
+    do { digits[d++] = '0' + v % 10; v /= 10; } while (v);
+    while (d > 0 && n < SCREEN_COLS)
+        out[n++] = digits[--d];
+    return n;
+}
+
+static void draw_entry(int i) {
+    char text[SCREEN_COLS];
+    int row = i - top;
+    if (row < 0 || row >= LIST_ROWS)
+        return;
+    if (row >= window_count) {
+        console_write_row(LIST_TOP + row, "", 0, ATTR_NORMAL);
+        return;
+    }
+    DirEntry *e = &window[row];
+    int n = append_str(text, 0, "  ");
+    n = append_str(text, n, e->name);
+    if (e->is_dir) {
+        n = append_str(text, n, "/");
+    } else {
+        while (n < 48)
+            text[n++] = ' ';
+        n = append_uint(text, n, e->size);
+        n = append_str(text, n, " bytes");
     }
-    return num;
+    unsigned char attr = i == sel ? ATTR_SELECT : e->is_dir ? ATTR_DIR : ATTR_NORMAL;
+    console_write_row(LIST_TOP + row, text, n, attr);
 }
 
-/* The file browser main loop.
-   It uses its own local pointer "cur" to track the directory being browsed.
-*/
-void file_browser(void) {
-    char input[32];
-    Node *cur = current_dir;  // Start at the current directory
+static void draw_header(void) {
+    char text[SCREEN_COLS];
+    int n = append_str(text, 0, " File Browser: ");
+    n = append_str(text, n, fs_name(iter.dir));
+    n = append_str(text, n, "  (");
+    n = append_uint(text, n, entry_count);
+    n = append_str(text, n, " entries)");
+    console_write_row(0, text, n, ATTR_BAR);
+}
+
+static void draw_status(void) {
+    char text[SCREEN_COLS];
+    int n = append_str(text, 0, " ");
+    n = append_uint(text, n, entry_count ? sel + 1 : 0);
+    n = append_str(text, n, "/");
+    n = append_uint(text, n, entry_count);
+    n = append_str(text, n, "  Enter open  Bksp up  Esc quit");
+    console_write_row(STATUS_ROW, text, n, ATTR_BAR);
+    console_flush();
+}
+
+// Fetches the entries for the current window and repaints the list.
+static void load_window(void) {
+    fs_seekdir(&iter, top);
+    window_count = fs_readdir(&iter, window, LIST_ROWS);
+    for (int i = top; i < top + LIST_ROWS; i++)
+        draw_entry(i);
+    draw_status();
+}
+
+static void open_dir(Node *dir) {
+    if (!fs_opendir(dir, &iter))
+        return;
+    entry_count = fs_dir_count(&iter);
+    top = sel = 0;
+    draw_header();
+    load_window();
+}
+
+// Moves the selection to index, scrolling the window only when it leaves
+// the screen.
+static void select_entry(int index) {
+    if (index >= entry_count)
+        index = entry_count - 1;
+    if (index < 0)
+        index = 0;
+    if (index == sel)
+        return;
+    int old = sel;
+    sel = index;
+    if (sel < top || sel >= top + LIST_ROWS) {
+        top = sel < top ? sel : sel - LIST_ROWS + 1;
+        load_window();
+        return;
+    }
+    draw_entry(old);
+    draw_entry(sel);
+    draw_status();
+}
+
+// ---- File viewer ----
+typedef struct {
+    Node *file;
+    unsigned int off;        // file offset of chunk[0]
+    unsigned int pos, len;
+    char chunk[512];
+} Reader;
+
+static int next_char(Reader *r) {
+    if (r->pos == r->len) {
+        r->off += r->len;
+        r->len = fs_file_read(r->file, r->off, r->chunk, sizeof(r->chunk));
+        r->pos = 0;
+        if (!r->len)
+            return -1;
+    }
+    return (unsigned char)r->chunk[r->pos++];
+}
+
+// Shows the file a screen at a time, reading only what is displayed.
+static void view_file(DirEntry *e) {
+    Reader r;
+    r.file = e->node;
+    r.off = r.pos = r.len = 0;
+    int c = 0;
     while (1) {
-        clear_screen();
-        print_string("File Browser - Current Directory: ");
-        print_string(cur->name);
-        print_string("\n----------------------\n");
-
-        // List entries with their indexes
-        int i;
-        for (i = 0; i < cur->dir.child_count; i++) {
-            Node *child = cur->dir.children[i];
-            print_string(" [");
-            /* For simplicity, convert the index (0..9) to a character. */
-            print_char('0' + i);
-            print_string("] ");
-            print_string(child->name);
-            if (child->type == DIR_NODE)
-                print_string(" (dir)");
-            print_string("\n");
+        for (int row = 0; row < VIEW_ROWS; row++) {
+            char text[SCREEN_COLS];
+            int n = 0;
+            while (n < SCREEN_COLS && c >= 0) {
+                c = next_char(&r);
+                if (c < 0 || c == '\n')
+                    break;
+                text[n++] = c < ' ' ? ' ' : (char)c;
+            }
+            console_write_row(row, text, n, ATTR_NORMAL);
+            if (c == '\n')
+                c = 0;
         }
-        print_string("----------------------\n");
-        print_string("Enter index to open file/dir, '..' to go up, 'q' to quit: ");
-        read_line(input, 32);
-
-        // Process input:
-        if (input[0] == 'q') {
+        char text[SCREEN_COLS];
+        int n = append_str(text, 0, " ");
+        n = append_str(text, n, e->name);
+        n = append_str(text, n, c < 0 ? "  (end)  any key: back" : "  any key: more  Esc: back");
+        console_write_row(STATUS_ROW, text, n, ATTR_BAR);
+        console_flush();
+        if (getkey() == KEY_ESC || c < 0)
             break;
-        } else if (input[0] == '.' && input[1] == '.') {
-            // Go up one level if possible
-            if (cur->parent)
-                cur = cur->parent;
-            else
-                print_string("Already at root directory.\n");
-        } else {
-            // Assume the input is a number
-            int index = simple_atoi(input);
-            if (index < 0 || index >= cur->dir.child_count) {
-                print_string("Invalid index.\n");
-            } else {
-                Node *child = cur->dir.children[index];
-                if (child->type == DIR_NODE) {
-                    cur = child;
-                } else {
-                    // For a file, display its content
-                    clear_screen();
-                    print_string("Viewing file: ");
-                    print_string(child->name);
-                    print_string("\n----------------------\n");
-                    print_string(child->content);
-                    print_string("\n----------------------\n");
-                    print_string("Press Enter to return.");
-                    read_line(input, 32);
-                }
+    }
+    draw_header();
+    load_window();
+}
+
+void file_browser(void) {
+    clear_screen();
+    console_set_cursor(STATUS_ROW, SCREEN_COLS - 1);
+    open_dir(fs_cwd());
+    while (1) {
+        int key = getkey();
+        switch (key) {
+        case KEY_UP:   select_entry(sel - 1); break;
+        case KEY_DOWN: select_entry(sel + 1); break;
+        case KEY_PGUP: select_entry(sel - LIST_ROWS); break;
+        case KEY_PGDN: select_entry(sel + LIST_ROWS); break;
+        case KEY_HOME: select_entry(0); break;
+        case KEY_END:  select_entry(entry_count - 1); break;
+        case '\n':
+            if (sel < top + window_count) {
+                DirEntry *e = &window[sel - top];
+                if (e->is_dir)
+                    open_dir(e->node);
+                else
+                    view_file(e);
             }
+            break;
+        case '\b':
+            if (fs_parent(iter.dir))
+                open_dir(fs_parent(iter.dir));
+            break;
+        case 'q':
+        case KEY_ESC:
+            clear_screen();
+            return;
         }
     }
 }
 
 /* The app's entry point.
-   When the kernel loads this application, it jumps to kmain.
+   When the kernel loads this application, it jumps to kmain; returning
+   goes back to the shell.
 */
 void kmain(void) {
     file_browser();
-    while (1) { }  // Halt when done.
 }
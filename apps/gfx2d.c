@@ -0,0 +1,312 @@
+/* gfx2d.c - 2D rasterization primitives for zOS graphics apps.
+   Link this file into an app and declare the functions you use as
+   externs, the same way apps declare kernel functions. Everything draws
+   8-bit pixels into the current target, which defaults to the kernel's
+   mode 13h back buffer; drawing there also marks the touched bounding
+   box dirty so gfx_flip() copies only what changed.
+
+   Outlines use the integer midpoint (circle, ellipse) and Bresenham
+   (line) algorithms. Filled shapes are decomposed into horizontal spans,
+   and spans, rectangle fills and blits move 4 bytes at a time. */
+
+extern unsigned char *gfx_backbuffer(void);
+extern void gfx_mark_dirty(int x, int y, int w, int h);
+
+#define G2D_MAX_POLY 64
+
+static unsigned char *g2d_pixels = 0;
+static int g2d_width = 320, g2d_height = 200, g2d_pitch = 320;
+static int g2d_track = 1;   /* target is the back buffer: mark dirty */
+
+/* Draws into an arbitrary 8-bit buffer (e.g. a sprite) from now on. */
+void g2d_target(unsigned char *pixels, int width, int height, int pitch) {
+    g2d_pixels = pixels;
+    g2d_width = width;
+    g2d_height = height;
+    g2d_pitch = pitch;
+    g2d_track = 0;
+}
+
+/* Draws into the 320x200 back buffer from now on (the default). */
+void g2d_target_screen(void) {
+    g2d_pixels = gfx_backbuffer();
+    g2d_width = 320;
+    g2d_height = 200;
+    g2d_pitch = 320;
+    g2d_track = 1;
+}
+
+static unsigned char *g2d_buf(void) {
+    if (!g2d_pixels)
+        g2d_target_screen();
+    return g2d_pixels;
+}
+
+static void g2d_dirty(int x0, int y0, int x1, int y1) {
+    if (g2d_track)
+        gfx_mark_dirty(x0, y0, x1 - x0 + 1, y1 - y0 + 1);
+}
+
+/* Fills n bytes: a byte at a time up to a dword boundary, then dwords. */
+static void g2d_fill_span(unsigned char *p, int n, unsigned char color) {
+    while (n > 0 && ((unsigned int)p & 3)) { *p++ = color; n--; }
+    unsigned int *d = (unsigned int *)p;
+    unsigned int v = color * 0x01010101u;
+    for (; n >= 16; n -= 16, d += 4) { d[0] = v; d[1] = v; d[2] = v; d[3] = v; }
+    for (; n >= 4; n -= 4) *d++ = v;
+    p = (unsigned char *)d;
+    while (n-- > 0) *p++ = color;
+}
+
+static void g2d_copy_span(unsigned char *dst, const unsigned char *src, int n) {
+    while (n > 0 && ((unsigned int)dst & 3)) { *dst++ = *src++; n--; }
+    unsigned int *d = (unsigned int *)dst;
+    const unsigned int *s = (const unsigned int *)src;
+    for (; n >= 4; n -= 4) *d++ = *s++;
+    dst = (unsigned char *)d;
+    src = (const unsigned char *)s;
+    while (n-- > 0) *dst++ = *src++;
+}
+
+static void g2d_plot(unsigned char *buf, int x, int y, unsigned char color) {
+    if ((unsigned int)x < (unsigned int)g2d_width && (unsigned int)y < (unsigned int)g2d_height)
+        buf[y * g2d_pitch + x] = color;
+}
+
+void g2d_pixel(int x, int y, unsigned char color) {
+    g2d_plot(g2d_buf(), x, y, color);
+    g2d_dirty(x, y, x, y);
+}
+
+/* Clipped horizontal span from x0 to x1 inclusive; no dirty marking. */
+static void g2d_span(unsigned char *buf, int x0, int x1, int y, unsigned char color) {
+    if ((unsigned int)y >= (unsigned int)g2d_height)
+        return;
+    if (x0 > x1) { int t = x0; x0 = x1; x1 = t; }
+    if (x0 < 0) x0 = 0;
+    if (x1 >= g2d_width) x1 = g2d_width - 1;
+    if (x0 <= x1)
+        g2d_fill_span(buf + y * g2d_pitch + x0, x1 - x0 + 1, color);
+}
+
+void g2d_hline(int x0, int x1, int y, unsigned char color) {
+    g2d_span(g2d_buf(), x0, x1, y, color);
+    g2d_dirty(x0 < x1 ? x0 : x1, y, x0 < x1 ? x1 : x0, y);
+}
+
+void g2d_fill_rect(int x, int y, int w, int h, unsigned char color) {
+    unsigned char *buf = g2d_buf();
+    if (x < 0) { w += x; x = 0; }
+    if (y < 0) { h += y; y = 0; }
+    if (x + w > g2d_width) w = g2d_width - x;
+    if (y + h > g2d_height) h = g2d_height - y;
+    if (w <= 0 || h <= 0)
+        return;
+    unsigned char *row = buf + y * g2d_pitch + x;
+    if (w == g2d_pitch) {
+        g2d_fill_span(row, w * h, color);  /* contiguous rows: one fill */
+    } else {
+        for (int i = 0; i < h; i++, row += g2d_pitch)
+            g2d_fill_span(row, w, color);
+    }
+    g2d_dirty(x, y, x + w - 1, y + h - 1);
+}
+
+/* Copies a w x h block from src (rows pitch bytes apart) to (x, y). */
+void g2d_blit(const unsigned char *src, int w, int h, int pitch, int x, int y) {
+    unsigned char *buf = g2d_buf();
+    if (x < 0) { src -= x; w += x; x = 0; }
+    if (y < 0) { src -= y * pitch; h += y; y = 0; }
+    if (x + w > g2d_width) w = g2d_width - x;
+    if (y + h > g2d_height) h = g2d_height - y;
+    if (w <= 0 || h <= 0)
+        return;
+    unsigned char *row = buf + y * g2d_pitch + x;
+    for (int i = 0; i < h; i++, row += g2d_pitch, src += pitch)
+        g2d_copy_span(row, src, w);
+    g2d_dirty(x, y, x + w - 1, y + h - 1);
+}
+
+/* Bresenham line with all-integer error terms. */
+void g2d_line(int x0, int y0, int x1, int y1, unsigned char color) {
+    unsigned char *buf = g2d_buf();
+    int dx = x1 > x0 ? x1 - x0 : x0 - x1;
+    int dy = y1 > y0 ? y0 - y1 : y1 - y0;   /* negative */
+    int sx = x0 < x1 ? 1 : -1;
+    int sy = y0 < y1 ? 1 : -1;
+    int err = dx + dy;
+    int bx0 = x0 < x1 ? x0 : x1, bx1 = x0 < x1 ? x1 : x0;
+    int by0 = y0 < y1 ? y0 : y1, by1 = y0 < y1 ? y1 : y0;
+    for (;;) {
+        g2d_plot(buf, x0, y0, color);
+        if (x0 == x1 && y0 == y1)
+            break;
+        int e2 = 2 * err;
+        if (e2 >= dy) { err += dy; x0 += sx; }
+        if (e2 <= dx) { err += dx; y0 += sy; }
+    }
+    g2d_dirty(bx0, by0, bx1, by1);
+}
+
+void g2d_rect(int x, int y, int w, int h, unsigned char color) {
+    if (w <= 0 || h <= 0)
+        return;
+    g2d_hline(x, x + w - 1, y, color);
+    g2d_hline(x, x + w - 1, y + h - 1, color);
+    g2d_line(x, y, x, y + h - 1, color);
+    g2d_line(x + w - 1, y, x + w - 1, y + h - 1, color);
+}
+
+/* Midpoint circle: one octant is walked and mirrored eight ways. */
+void g2d_circle(int cx, int cy, int r, unsigned char color) {
+    unsigned char *buf = g2d_buf();
+    int x = r, y = 0, d = 1 - r;
+    while (y <= x) {
+        g2d_plot(buf, cx + x, cy + y, color);
+        g2d_plot(buf, cx - x, cy + y, color);
+        g2d_plot(buf, cx + x, cy - y, color);
+        g2d_plot(buf, cx - x, cy - y, color);
+        g2d_plot(buf, cx + y, cy + x, color);
+        g2d_plot(buf, cx - y, cy + x, color);
+        g2d_plot(buf, cx + y, cy - x, color);
+        g2d_plot(buf, cx - y, cy - x, color);
+        y++;
+        if (d < 0) {
+            d += 2 * y + 1;
+        } else {
+            x--;
+            d += 2 * (y - x) + 1;
+        }
+    }
+    g2d_dirty(cx - r, cy - r, cx + r, cy + r);
+}
+
+/* Filled circle from the same walk: each step yields up to four spans. */
+void g2d_fill_circle(int cx, int cy, int r, unsigned char color) {
+    unsigned char *buf = g2d_buf();
+    int x = r, y = 0, d = 1 - r;
+    while (y <= x) {
+        g2d_span(buf, cx - x, cx + x, cy + y, color);
+        if (y) g2d_span(buf, cx - x, cx + x, cy - y, color);
+        y++;
+        if (d < 0) {
+            d += 2 * y + 1;
+        } else {
+            /* x is about to shrink: this is the last row at width y-1. */
+            if (x != y - 1) {
+                g2d_span(buf, cx - (y - 1), cx + (y - 1), cy + x, color);
+                g2d_span(buf, cx - (y - 1), cx + (y - 1), cy - x, color);
+            }
+            x--;
+            d += 2 * (y - x) + 1;
+        }
+    }
+    g2d_dirty(cx - r, cy - r, cx + r, cy + r);
+}
+
+/* Midpoint ellipse in two regions (slope above and below -1), shared by
+   the outline (four mirrored points per step) and the fill (two spans). */
+static void g2d_ellipse_walk(int cx, int cy, int rx, int ry, unsigned char color, int fill) {
+    unsigned char *buf = g2d_buf();
+    long long rx2 = (long long)rx * rx, ry2 = (long long)ry * ry;
+    int x = 0, y = ry;
+    long long px = 0, py = 2 * rx2 * y;
+    /* Region 1 */
+    long long p = ry2 - rx2 * ry + rx2 / 4;
+    while (px < py) {
+        if (fill) {
+            g2d_span(buf, cx - x, cx + x, cy + y, color);
+            g2d_span(buf, cx - x, cx + x, cy - y, color);
+        } else {
+            g2d_plot(buf, cx + x, cy + y, color);
+            g2d_plot(buf, cx - x, cy + y, color);
+            g2d_plot(buf, cx + x, cy - y, color);
+            g2d_plot(buf, cx - x, cy - y, color);
+        }
+        x++;
+        px += 2 * ry2;
+        if (p < 0) {
+            p += ry2 + px;
+        } else {
+            y--;
+            py -= 2 * rx2;
+            p += ry2 + px - py;
+        }
+    }
+    /* Region 2 */
+    p = ry2 * (2 * x + 1) * (2 * x + 1) / 4 + rx2 * (y - 1) * (y - 1) - rx2 * ry2;
+    while (y >= 0) {
+        if (fill) {
+            g2d_span(buf, cx - x, cx + x, cy + y, color);
+            if (y) g2d_span(buf, cx - x, cx + x, cy - y, color);
+        } else {
+            g2d_plot(buf, cx + x, cy + y, color);
+            g2d_plot(buf, cx - x, cy + y, color);
+            g2d_plot(buf, cx + x, cy - y, color);
+            g2d_plot(buf, cx - x, cy - y, color);
+        }
+        y--;
+        py -= 2 * rx2;
+        if (p > 0) {
+            p += rx2 - py;
+        } else {
+            x++;
+            px += 2 * ry2;
+            p += rx2 - py + px;
+        }
+    }
+    g2d_dirty(cx - rx, cy - ry, cx + rx, cy + ry);
+}
+
+void g2d_ellipse(int cx, int cy, int rx, int ry, unsigned char color) {
+    g2d_ellipse_walk(cx, cy, rx, ry, color, 0);
+}
+
+void g2d_fill_ellipse(int cx, int cy, int rx, int ry, unsigned char color) {
+    g2d_ellipse_walk(cx, cy, rx, ry, color, 1);
+}
+
+/* Scanline polygon fill (even-odd rule). xy holds n vertex pairs. For each
+   row the crossings of every edge at the pixel center are found in 16.16
+   fixed point, sorted, and filled pairwise. */
+void g2d_fill_polygon(const int *xy, int n, unsigned char color) {
+    unsigned char *buf = g2d_buf();
+    int xs[G2D_MAX_POLY];
+    if (n < 3 || n > G2D_MAX_POLY)
+        return;
+    int ymin = xy[1], ymax = xy[1], xmin = xy[0], xmax = xy[0];
+    for (int i = 1; i < n; i++) {
+        if (xy[2 * i + 1] < ymin) ymin = xy[2 * i + 1];
+        if (xy[2 * i + 1] > ymax) ymax = xy[2 * i + 1];
+        if (xy[2 * i] < xmin) xmin = xy[2 * i];
+        if (xy[2 * i] > xmax) xmax = xy[2 * i];
+    }
+    int y0 = ymin < 0 ? 0 : ymin;
+    int y1 = ymax >= g2d_height ? g2d_height - 1 : ymax;
+    for (int y = y0; y <= y1; y++) {
+        int count = 0;
+        int yc = (y << 16) + 0x8000;   /* pixel center */
+        for (int i = 0; i < n; i++) {
+            int j = i + 1 == n ? 0 : i + 1;
+            int ya = xy[2 * i + 1], yb = xy[2 * j + 1];
+            int xa = xy[2 * i], xb = xy[2 * j];
+            if (ya == yb || (yc < (ya << 16) && yc < (yb << 16)) ||
+                (yc >= (ya << 16) && yc >= (yb << 16)))
+                continue;  /* horizontal, or the row misses this edge */
+            /* |slope * (y - ya)| never exceeds |xb - xa| << 16 */
+            int slope = ((xb - xa) << 16) / (yb - ya);
+            int x = (xa << 16) + slope * (y - ya) + slope / 2;
+            /* insertion sort by x */
+            int k = count++;
+            while (k > 0 && xs[k - 1] > x) { xs[k] = xs[k - 1]; k--; }
+            xs[k] = x;
+        }
+        for (int k = 0; k + 1 < count; k += 2) {
+            int xl = (xs[k] + 0x8000) >> 16;         /* first center inside */
+            int xr = ((xs[k + 1] + 0x8000) >> 16) - 1;
+            if (xl <= xr)
+                g2d_span(buf, xl, xr, y, color);
+        }
+    }
+    g2d_dirty(xmin, ymin, xmax, ymax);
+}
@@ -0,0 +1,154 @@
+/* gfx_bench_app.c - Rasterization benchmark for zOS.
+   Times the gfx2d.c primitives against the brute-force versions the
+   graphics apps used to carry (a full-screen distance test per circle and
+   per-pixel index math per frame), drawing into the mode 13h back buffer.
+   Each case runs for about BENCH_MS milliseconds; the results are printed
+   as primitives per second after returning to text mode.
+   Link with gfx2d.c. */
+
+extern int vga_set_mode(int mode);
+extern unsigned char *gfx_backbuffer(void);
+extern void gfx_mark_all(void);
+extern void gfx_clear(unsigned char color);
+extern void gfx_flip(void);
+extern unsigned int timer_ms(void);
+extern void print_string(const char *str);
+extern void print_uint(unsigned int value);
+
+extern void g2d_target_screen(void);
+extern void g2d_line(int x0, int y0, int x1, int y1, unsigned char color);
+extern void g2d_circle(int cx, int cy, int r, unsigned char color);
+extern void g2d_fill_circle(int cx, int cy, int r, unsigned char color);
+extern void g2d_ellipse(int cx, int cy, int rx, int ry, unsigned char color);
+extern void g2d_fill_polygon(const int *xy, int n, unsigned char color);
+extern void g2d_fill_rect(int x, int y, int w, int h, unsigned char color);
+extern void g2d_blit(const unsigned char *src, int w, int h, int pitch, int x, int y);
+
+#define BENCH_MS 250
+#define BENCH_CASES 10
+
+typedef struct {
+    const char *name;
+    unsigned int count;
+    unsigned int ms;
+} BenchResult;
+
+static BenchResult results[BENCH_CASES];
+static int result_count = 0;
+static unsigned char sprite[32 * 32];
+
+// Old vga_circle_app.c outline: tests every pixel on the screen.
+static void brute_circle(int cx, int cy, int r, unsigned char color) {
+    unsigned char *back = gfx_backbuffer();
+    int inner_sq = (r - 1) * (r - 1), outer_sq = (r + 1) * (r + 1);
+    for (int y = 0; y < 200; y++) {
+        for (int x = 0; x < 320; x++) {
+            int d = (x - cx) * (x - cx) + (y - cy) * (y - cy);
+            if (d >= inner_sq && d <= outer_sq)
+                back[y * 320 + x] = color;
+        }
+    }
+}
+
+static void brute_fill_circle(int cx, int cy, int r, unsigned char color) {
+    unsigned char *back = gfx_backbuffer();
+    for (int y = 0; y < 200; y++)
+        for (int x = 0; x < 320; x++)
+            if ((x - cx) * (x - cx) + (y - cy) * (y - cy) <= r * r)
+                back[y * 320 + x] = color;
+}
+
+// Old vga_graphics_app.c frame: one index computation per pixel.
+static void brute_screen(unsigned char color) {
+    unsigned char *back = gfx_backbuffer();
+    for (int y = 0; y < 200; y++)
+        for (int x = 0; x < 320; x++)
+            back[y * 320 + x] = color;
+}
+
+static void brute_blit(const unsigned char *src, int w, int h, int dx, int dy) {
+    unsigned char *back = gfx_backbuffer();
+    for (int y = 0; y < h; y++)
+        for (int x = 0; x < w; x++)
+            back[(dy + y) * 320 + dx + x] = src[y * w + x];
+}
+
+static void run_case(const char *name, int which) {
+    static const int star[] = { 160, 20, 180, 80, 240, 80, 190, 115, 210, 180,
+                                160, 140, 110, 180, 130, 115, 80, 80, 140, 80 };
+    unsigned int count = 0, start = timer_ms(), now;
+    unsigned int i = 0;
+    do {
+        // Vary position and color a little so nothing is optimized away.
+        int ox = (int)(i & 31) - 16;
+        unsigned char c = (unsigned char)(32 + (i & 127));
+        switch (which) {
+        case 0: brute_circle(160 + ox, 100, 50, c); break;
+        case 1: g2d_circle(160 + ox, 100, 50, c); break;
+        case 2: brute_fill_circle(160 + ox, 100, 50, c); break;
+        case 3: g2d_fill_circle(160 + ox, 100, 50, c); break;
+        case 4: brute_screen(c); break;
+        case 5: g2d_fill_rect(0, 0, 320, 200, c); break;
+        case 6: brute_blit(sprite, 32, 32, 100 + ox, 84); break;
+        case 7: g2d_blit(sprite, 32, 32, 32, 100 + ox, 84); break;
+        case 8: g2d_line(0, (int)(i % 200), 319, 199 - (int)(i % 200), c); break;
+        case 9: g2d_fill_polygon(star, 10, c); g2d_ellipse(160, 100, 90, 40 + ox, c); break;
+        }
+        count++;
+        i++;
+        now = timer_ms();
+    } while (now - start < BENCH_MS);
+    gfx_mark_all();
+    gfx_flip();
+    results[result_count].name = name;
+    results[result_count].count = count;
+    results[result_count].ms = now - start;
+    result_count++;
+}
+
+static unsigned int per_second(const BenchResult *r) {
+    if (!r->ms)
+        return 0;
+    return r->count / r->ms * 1000 + r->count % r->ms * 1000 / r->ms;
+}
+
+static void print_row(const BenchResult *r) {
+    print_string("  ");
+    print_string(r->name);
+    print_string(": ");
+    print_uint(per_second(r));
+    print_string("/s\n");
+}
+
+void kmain(void) {
+    for (int i = 0; i < 32 * 32; i++)
+        sprite[i] = (unsigned char)(16 + (i & 15));
+    if (!vga_set_mode(0x13))
+        return;
+    g2d_target_screen();
+    gfx_clear(0);
+    result_count = 0;
+    run_case("circle, full-screen scan", 0);
+    run_case("circle, midpoint", 1);
+    run_case("filled circle, full-screen scan", 2);
+    run_case("filled circle, spans", 3);
+    run_case("screen fill, per pixel", 4);
+    run_case("screen fill, dwords", 5);
+    run_case("32x32 blit, per pixel", 6);
+    run_case("32x32 blit, dwords", 7);
+    run_case("line 320px, Bresenham", 8);
+    run_case("star polygon + ellipse", 9);
+    vga_set_mode(0x03);
+
+    print_string("gfx2d benchmark (primitives per second):\n");
+    for (int i = 0; i < result_count; i++) {
+        print_row(&results[i]);
+        // Pairs: brute force first, then the library version.
+        if (i < 8 && (i & 1)) {
+            unsigned int slow = per_second(&results[i - 1]);
+            print_string("    speedup: ");
+            print_uint(slow ? per_second(&results[i]) / slow : 0);
+            print_string("x\n");
+        }
+    }
+}
@@ -1,7 +1,7 @@
 ; hello_app.asm
 ; Assemble with: nasm -f bin hello_app.asm -o hello_app.bin
 BITS 32
-org 0x1000    ; This is the address where the kernel loads the app
+org 0x300000  ; APP_LOAD_ADDR: fs_run copies the app here and calls it
 
 global _start
 _start:
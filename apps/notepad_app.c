@@ -1,58 +1,466 @@
-/* notepad_app.c - A simple Notepad application for zOS.
-   Type text lines. Type ".exit" on a new line to finish editing.
-   The final text is displayed on screen.
-   
-   This app uses the kernel's console I/O routines:
-     - print_string(const char *str)
-     - print_char(char c)
-     - read_line(char *buffer, int max_length)
-     - clear_screen(void)
-     
-   It assumes these functions are available as externs.
+/* notepad_app.c - A full-screen Notepad application for zOS.
+   Opens a file in the current directory (or starts a new one), moves
+   around with the arrow keys, Home/End and PgUp/PgDn, inserts and deletes
+   anywhere, and saves back to the FS with Ctrl+S. Esc quits; with unsaved
+   changes it has to be pressed twice.
+
+   The text lives in a gap buffer: the free space sits at the cursor, so
+   typing and deleting only touch the gap, and moving the gap costs the
+   distance moved rather than the document size. The buffer is taken from
+   the page heap and doubles when full, so files are limited only by free
+   memory. Redraw is per row: a keystroke inside a line repaints that row
+   and the status line, and only newlines, joins and scrolling repaint
+   more. Line and column are tracked as the cursor moves, so the work per
+   key does not grow with the document.
+
+   This app uses these kernel routines:
+     - getkey(), console_write_row(), console_set_cursor(), console_flush()
+     - fs_open(), fs_file_size(), fs_file_read(), fs_file_clear(), fs_file_write()
+     - allocate_node(), free_node(), fs_file_swap()
+     - page_alloc(), page_free(), memmove(), memcpy()
 */
 
+typedef struct Node Node;
+
 extern void print_string(const char *str);
-extern void print_char(char c);
 extern void read_line(char *buffer, int max_length);
 extern void clear_screen(void);
+extern int getkey(void);
+extern void console_write_row(int row, const char *text, int len, unsigned char attr);
+extern void console_set_cursor(int row, int col);
+extern void console_flush(void);
+extern Node *fs_open(const char *name, int create);
+extern unsigned int fs_file_size(Node *file);
+extern unsigned int fs_file_read(Node *file, unsigned int off, void *buf, unsigned int len);
+extern void fs_file_clear(Node *file);
+extern int fs_file_write(Node *file, const void *data, unsigned int len);
+extern void fs_file_swap(Node *a, Node *b);
+extern Node *allocate_node(void);
+extern void free_node(Node *node);
+extern void *page_alloc(unsigned int count);
+extern void page_free(void *addr, unsigned int count);
+extern void *memmove(void *dst, const void *src, unsigned int n);
+extern void *memcpy(void *dst, const void *src, unsigned int n);
+
+#define KEY_UP    0x100
+#define KEY_DOWN  0x101
+#define KEY_LEFT  0x102
+#define KEY_RIGHT 0x103
+#define KEY_HOME  0x104
+#define KEY_END   0x105
+#define KEY_PGUP  0x106
+#define KEY_PGDN  0x107
+#define KEY_DEL   0x109
+#define KEY_CTRL_S 19
+#define KEY_ESC    27
+
+#define SCREEN_COLS 80
+#define TEXT_ROWS   24          // row 24 is the status line
+#define STATUS_ROW  24
+#define PAGE_BYTES  4096
+#define TAB_WIDTH   4
+#define NO_ROW      0xFFFFFFFFu
+
+// ---- Gap buffer ----
+// Text is buf[0, gap_start) followed by buf[gap_end, cap).
+static char *gb_buf = 0;
+static unsigned int gb_cap = 0;
+static unsigned int gb_gap_start = 0;
+static unsigned int gb_gap_end = 0;
 
-int strcmp(const char *s1, const char *s2) {
-    while (*s1 && *s1 == *s2) { s1++; s2++; }
-    return *(unsigned char*)s1 - *(unsigned char*)s2;
+static unsigned int gb_len(void) {
+    return gb_cap - (gb_gap_end - gb_gap_start);
 }
 
-void notepad_main(void) {
-    char text[5120];  // A 5KB text buffer
-    int pos = 0;
-    text[0] = '\0';
-    clear_screen();
-    print_string("zOS Notepad Application\n");
-    print_string("Enter text lines. Type \".exit\" to finish editing.\n");
+static char gb_at(unsigned int i) {
+    return i < gb_gap_start ? gb_buf[i] : gb_buf[i + (gb_gap_end - gb_gap_start)];
+}
+
+static void gb_move_gap(unsigned int pos) {
+    if (pos < gb_gap_start) {
+        unsigned int n = gb_gap_start - pos;
+        memmove(gb_buf + gb_gap_end - n, gb_buf + pos, n);
+        gb_gap_start -= n;
+        gb_gap_end -= n;
+    } else if (pos > gb_gap_start) {
+        unsigned int n = pos - gb_gap_start;
+        memmove(gb_buf + gb_gap_start, gb_buf + gb_gap_end, n);
+        gb_gap_start += n;
+        gb_gap_end += n;
+    }
+}
+
+// Grows the buffer so it holds more than need bytes, keeping the gap.
+static int gb_reserve(unsigned int need) {
+    if (need < gb_cap)
+        return 1;
+    unsigned int cap = gb_cap ? gb_cap : PAGE_BYTES;
+    while (cap <= need)
+        cap *= 2;
+    char *buf = (char *)page_alloc(cap / PAGE_BYTES);
+    if (!buf)
+        return 0;
+    unsigned int tail = gb_cap - gb_gap_end;
+    if (gb_buf) {
+        memcpy(buf, gb_buf, gb_gap_start);
+        memcpy(buf + cap - tail, gb_buf + gb_gap_end, tail);
+        page_free(gb_buf, gb_cap / PAGE_BYTES);
+    }
+    gb_buf = buf;
+    gb_gap_end = cap - tail;
+    gb_cap = cap;
+    return 1;
+}
+
+static int gb_insert(unsigned int pos, char c) {
+    if (gb_gap_start == gb_gap_end && !gb_reserve(gb_cap))
+        return 0;
+    gb_move_gap(pos);
+    gb_buf[gb_gap_start++] = c;
+    return 1;
+}
+
+static void gb_delete(unsigned int pos) {
+    gb_move_gap(pos);
+    gb_gap_end++;
+}
+
+static void gb_free(void) {
+    if (gb_buf)
+        page_free(gb_buf, gb_cap / PAGE_BYTES);
+    gb_buf = 0;
+    gb_cap = gb_gap_start = gb_gap_end = 0;
+}
+
+// ---- Editor state ----
+static char ed_name[32];
+static unsigned int ed_cur = 0;        // cursor offset into the text
+static unsigned int ed_line = 0;       // line number of the cursor
+static unsigned int ed_want_col = 0;   // column kept across up/down moves
+static unsigned int ed_top = 0;        // offset of the first visible line
+static unsigned int ed_top_line = 0;
+static unsigned int ed_left = 0;       // first visible column
+static unsigned int ed_row_start[TEXT_ROWS];
+static unsigned char ed_dirty[TEXT_ROWS];
+static int ed_modified = 0;
+static const char *ed_message = 0;
+
+static unsigned int line_start(unsigned int pos) {
+    while (pos > 0 && gb_at(pos - 1) != '\n')
+        pos--;
+    return pos;
+}
+
+static unsigned int line_end(unsigned int pos) {
+    unsigned int len = gb_len();
+    while (pos < len && gb_at(pos) != '\n')
+        pos++;
+    return pos;
+}
+
+static unsigned int cursor_col(void) {
+    return ed_cur - line_start(ed_cur);
+}
+
+static int cursor_screen_row(void) {
+    return (int)(ed_line - ed_top_line);
+}
+
+static void mark_rows_from(int row) {
+    for (int r = row < 0 ? 0 : row; r < TEXT_ROWS; r++)
+        ed_dirty[r] = 1;
+}
+
+// Finds where each visible row starts by walking forward from ed_top, so
+// only the text on screen is scanned.
+static void layout_rows(void) {
+    unsigned int pos = ed_top, len = gb_len();
+    for (int r = 0; r < TEXT_ROWS; r++) {
+        if (pos > len) {
+            ed_row_start[r] = NO_ROW;
+            continue;
+        }
+        ed_row_start[r] = pos;
+        pos = line_end(pos) + 1;
+    }
+}
+
+// Moves the view so the cursor is visible; any scroll repaints all rows.
+static void scroll_to_cursor(void) {
+    if (ed_line < ed_top_line) {
+        while (ed_top_line > ed_line) {
+            ed_top = line_start(ed_top - 1);
+            ed_top_line--;
+        }
+        mark_rows_from(0);
+    } else if (ed_line >= ed_top_line + TEXT_ROWS) {
+        while (ed_line >= ed_top_line + TEXT_ROWS) {
+            ed_top = line_end(ed_top) + 1;
+            ed_top_line++;
+        }
+        mark_rows_from(0);
+    }
+    unsigned int col = cursor_col();
+    if (col < ed_left) {
+        ed_left = col;
+        mark_rows_from(0);
+    } else if (col >= ed_left + SCREEN_COLS) {
+        ed_left = col - SCREEN_COLS + 1;
+        mark_rows_from(0);
+    }
+}
+
+static void draw_row(int r) {
+    char text[SCREEN_COLS];
+    int n = 0;
+    unsigned int pos = ed_row_start[r];
+    if (pos == NO_ROW) {
+        text[n++] = '~';
+        console_write_row(r, text, n, 0x01);
+        return;
+    }
+    unsigned int end = line_end(pos);
+    pos += ed_left < end - pos ? ed_left : end - pos;
+    for (; pos < end && n < SCREEN_COLS; pos++) {
+        char c = gb_at(pos);
+        text[n++] = (unsigned char)c < ' ' ? ' ' : c;
+    }
+    console_write_row(r, text, n, 0x07);
+}
+
+static int append_str(char *out, int n, const char *s) {
+    while (*s && n < SCREEN_COLS)
+        out[n++] = *s++;
+    return n;
+}
+
+static int append_uint(char *out, int n, unsigned int v) {
+    char digits[10];
+    int d = 0;
+    do { digits[d++] = '0' + v % 10; v /= 10; } while (v);
+    while (d > 0 && n < SCREEN_COLS)
+        out[n++] = digits[--d];
+    return n;
+}
+
+static void draw_status(void) {
+    char text[SCREEN_COLS];
+    int n = append_str(text, 0, " ");
+    n = append_str(text, n, ed_name);
+    n = append_str(text, n, ed_modified ? " [+]" : "");
+    n = append_str(text, n, "  Ln ");
+    n = append_uint(text, n, ed_line + 1);
+    n = append_str(text, n, ", Col ");
+    n = append_uint(text, n, cursor_col() + 1);
+    n = append_str(text, n, "  ");
+    n = append_str(text, n, ed_message ? ed_message : "^S save  Esc quit");
+    console_write_row(STATUS_ROW, text, n, 0x70);
+    ed_message = 0;
+}
+
+static void refresh(void) {
+    scroll_to_cursor();
+    layout_rows();
+    for (int r = 0; r < TEXT_ROWS; r++) {
+        if (ed_dirty[r]) {
+            draw_row(r);
+            ed_dirty[r] = 0;
+        }
+    }
+    draw_status();
+    console_set_cursor(cursor_screen_row(), (int)(cursor_col() - ed_left));
+    console_flush();
+}
+
+// ---- Cursor movement ----
+static void move_left(void) {
+    if (ed_cur == 0)
+        return;
+    ed_cur--;
+    if (gb_at(ed_cur) == '\n')
+        ed_line--;
+}
+
+static void move_right(void) {
+    if (ed_cur >= gb_len())
+        return;
+    if (gb_at(ed_cur) == '\n')
+        ed_line++;
+    ed_cur++;
+}
+
+// Moves to column ed_want_col of the line starting at start, or its end.
+static void move_to_col(unsigned int start) {
+    unsigned int end = line_end(start);
+    ed_cur = ed_want_col < end - start ? start + ed_want_col : end;
+}
+
+static void move_up(void) {
+    unsigned int start = line_start(ed_cur);
+    if (start == 0)
+        return;
+    move_to_col(line_start(start - 1));
+    ed_line--;
+}
+
+static void move_down(void) {
+    unsigned int end = line_end(ed_cur);
+    if (end >= gb_len())
+        return;
+    move_to_col(end + 1);
+    ed_line++;
+}
+
+// ---- Editing ----
+static void insert_char(char c) {
+    int row = cursor_screen_row();
+    if (!gb_insert(ed_cur, c)) {
+        ed_message = "Out of memory!";
+        return;
+    }
+    ed_cur++;
+    ed_modified = 1;
+    if (c == '\n') {
+        ed_line++;
+        mark_rows_from(row);
+    } else {
+        ed_dirty[row] = 1;
+    }
+}
+
+// Deletes the character under the cursor; joining lines shifts every row
+// below, otherwise only the cursor row changes.
+static void delete_char(void) {
+    if (ed_cur >= gb_len())
+        return;
+    char c = gb_at(ed_cur);
+    gb_delete(ed_cur);
+    ed_modified = 1;
+    if (c == '\n')
+        mark_rows_from(cursor_screen_row());
+    else
+        ed_dirty[cursor_screen_row()] = 1;
+}
+
+static void backspace(void) {
+    if (ed_cur == 0)
+        return;
+    move_left();
+    // Scroll first if the cursor moved above the view, so the row is valid.
+    scroll_to_cursor();
+    delete_char();
+}
+
+// ---- Files ----
+static int load_file(const char *name) {
+    Node *file = fs_open(name, 0);
+    if (!file)
+        return 0;
+    unsigned int size = fs_file_size(file);
+    if (!gb_reserve(size))
+        return -1;
+    // The buffer is empty: read into its end and leave the gap in front.
+    gb_gap_end = gb_cap - size;
+    fs_file_read(file, 0, gb_buf + gb_gap_end, size);
+    return 1;
+}
+
+// The text is written to a scratch node first and swapped into the file
+// only once all of it is stored, so a failed save leaves the file intact.
+static int save_file(void) {
+    Node *file = fs_open(ed_name, 1);
+    if (!file)
+        return 0;
+    Node *tmp = allocate_node();
+    if (!tmp)
+        return 0;
+    int ok = fs_file_write(tmp, gb_buf, gb_gap_start) &&
+             fs_file_write(tmp, gb_buf + gb_gap_end, gb_cap - gb_gap_end);
+    if (ok)
+        fs_file_swap(file, tmp);
+    fs_file_clear(tmp);
+    free_node(tmp);
+    if (!ok)
+        return 0;
+    ed_modified = 0;
+    return 1;
+}
+
+static void edit_loop(void) {
+    int quit_armed = 0;
+    mark_rows_from(0);
     while (1) {
-        print_string("> ");
-        char line[256];
-        read_line(line, 256);
-        if (strcmp(line, ".exit") == 0)
+        refresh();
+        int key = getkey();
+        if (key != KEY_ESC)
+            quit_armed = 0;
+        switch (key) {
+        case KEY_LEFT:  move_left(); break;
+        case KEY_RIGHT: move_right(); break;
+        case KEY_UP:    move_up(); break;
+        case KEY_DOWN:  move_down(); break;
+        case KEY_HOME:  ed_cur = line_start(ed_cur); break;
+        case KEY_END:   ed_cur = line_end(ed_cur); break;
+        case KEY_PGUP:  for (int i = 0; i < TEXT_ROWS - 1; i++) move_up(); break;
+        case KEY_PGDN:  for (int i = 0; i < TEXT_ROWS - 1; i++) move_down(); break;
+        case KEY_DEL:   delete_char(); break;
+        case '\b':      backspace(); break;
+        case '\t':      for (int i = 0; i < TAB_WIDTH; i++) insert_char(' '); break;
+        case KEY_CTRL_S:
+            ed_message = save_file() ? "Saved." : "Save failed!";
+            break;
+        case KEY_ESC:
+            if (!ed_modified || quit_armed)
+                return;
+            quit_armed = 1;
+            ed_message = "Unsaved changes: Esc again to discard, ^S to save";
+            break;
+        default:
+            if (key == '\n' || (key >= ' ' && key < 0x7F))
+                insert_char((char)key);
             break;
-        // Append the line into our text buffer
-        int i = 0;
-        while (line[i] && pos < 5119) {
-            text[pos++] = line[i++];
-        }
-        if (pos < 5119) {
-            text[pos++] = '\n';
         }
-        text[pos] = '\0';
+        // Vertical moves keep the column they started from.
+        if (key != KEY_UP && key != KEY_DOWN && key != KEY_PGUP && key != KEY_PGDN)
+            ed_want_col = cursor_col();
+    }
+}
+
+// Edits name in the current directory, creating it on first save.
+void notepad_edit(const char *name) {
+    int i = 0;
+    while (name[i] && i < 31) { ed_name[i] = name[i]; i++; }
+    ed_name[i] = '\0';
+    ed_cur = ed_line = ed_want_col = ed_top = ed_top_line = ed_left = 0;
+    ed_modified = 0;
+    ed_message = 0;
+    if (!gb_reserve(0)) {
+        print_string("Out of memory.\n");
+        return;
+    }
+    int loaded = load_file(ed_name);
+    if (loaded < 0) {
+        print_string("File too large for memory.\n");
+        gb_free();
+        return;
     }
+    if (!loaded)
+        ed_message = "New file.";
+    clear_screen();
+    edit_loop();
+    gb_free();
+    clear_screen();
+}
+
+void notepad_main(void) {
+    char name[32];
     clear_screen();
-    print_string("Notepad Content:\n");
-    print_string(text);
-    print_string("\nPress Enter to exit.");
-    char dummy[16];
-    read_line(dummy, 16);
+    print_string("zOS Notepad\n");
+    print_string("File to open (blank for untitled.txt): ");
+    read_line(name, 32);
+    notepad_edit(name[0] ? name : "untitled.txt");
 }
 
 void kmain(void) {
     notepad_main();
-    while (1) { }
 }
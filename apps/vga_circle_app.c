@@ -1,63 +1,30 @@
-/* vga_circle_app.c - VGA Graphics App that draws a circle */
+/* vga_circle_app.c - VGA Graphics App that draws a circle.
+   Link with gfx2d.c. */
 
-void set_mode_13h(void) {
-    asm volatile (
-        "mov $0x0013, %%ax\n"  // Mode 13h: 320x200 256-color
-        "int $0x10\n"
-        : : : "ax"
-    );
-}
-
-void set_mode_03h(void) {
-    asm volatile (
-        "mov $0x0003, %%ax\n"  // Mode 03h: 80x25 text mode
-        "int $0x10\n"
-        : : : "ax"
-    );
-}
-
-void delay(void) {
-    volatile unsigned long count = 50000000;
-    while (count--) { }
-}
+extern int vga_set_mode(int mode);
+extern void gfx_clear(unsigned char color);
+extern void gfx_flip(void);
+extern void sleep_ms(unsigned int ms);
+extern void g2d_circle(int cx, int cy, int r, unsigned char color);
 
 void draw_circle(int center_x, int center_y, int radius, unsigned char color) {
-    // In VGA mode 13h, the framebuffer starts at physical address 0xA0000.
-    unsigned char *vga = (unsigned char *)0xA0000;
-    int x, y;
-    // Pre-calculate the square of the radius and a small band around it.
-    int inner_sq = (radius - 1) * (radius - 1);
-    int outer_sq = (radius + 1) * (radius + 1);
-    
-    // Loop over all pixels in the 320x200 screen.
-    for (y = 0; y < 200; y++) {
-        for (x = 0; x < 320; x++) {
-            int dx = x - center_x;
-            int dy = y - center_y;
-            int dist_sq = dx * dx + dy * dy;
-            // If the pixel's distance squared is within a small band around the radius,
-            // draw it as part of the circle's outline.
-            if (dist_sq >= inner_sq && dist_sq <= outer_sq) {
-                vga[y * 320 + x] = color;
-            }
-        }
-    }
+    // Midpoint circle from gfx2d.c: touches only the outline's pixels
+    // (about 6*r of them) instead of testing all 64000 on screen.
+    g2d_circle(center_x, center_y, radius, color);
 }
 
 void kmain(void) {
-    set_mode_13h();  // Switch to VGA graphics mode (320x200, 256-color)
+    if (!vga_set_mode(0x13))  // Switch to VGA graphics mode (320x200, 256-color)
+        return;
 
     // Clear the screen (fill with color 0)
-    unsigned char *vga = (unsigned char *)0xA0000;
-    for (int i = 0; i < 320 * 200; i++) {
-        vga[i] = 0;
-    }
+    gfx_clear(0);
     
     // Draw a red circle at the center of the screen (160,100) with a radius of 50 pixels.
-    // In VGA mode 13h, color 4 is typically a red color.
+    // Color 4 is red in the driver's EGA-compatible palette.
     draw_circle(160, 100, 50, 4);
+    gfx_flip();
     
-    delay();         // Pause so the circle can be seen
-    set_mode_03h();  // Switch back to text mode
-    while (1);       // Halt
+    sleep_ms(2000);      // Pause so the circle can be seen
+    vga_set_mode(0x03);  // Switch back to text mode
 }
@@ -1,50 +1,31 @@
 /* vga_graphics_app.c - A simple VGA graphics application for zOS.
-   This app switches to VGA mode 13h, draws a color gradient, waits a bit,
-   and then restores text mode (03h). */
+   This app switches to VGA mode 13h through the kernel's mode-set driver,
+   scrolls a color gradient for a few seconds using the back buffer, and
+   then restores text mode (03h). Link with gfx2d.c. */
 
-void set_mode_13h(void) {
-    asm volatile (
-        "mov $0x0013, %%ax\n"  // 0x13 = 320x200 256-color mode
-        "int $0x10\n"
-        :
-        :
-        : "ax"
-    );
-}
-
-void set_mode_03h(void) {
-    asm volatile (
-        "mov $0x0003, %%ax\n"  // 0x03 = 80x25 text mode
-        "int $0x10\n"
-        :
-        :
-        : "ax"
-    );
-}
+extern int vga_set_mode(int mode);
+extern void gfx_flip(void);
+extern void sleep_ms(unsigned int ms);
+extern void g2d_blit(const unsigned char *src, int w, int h, int pitch, int x, int y);
 
-void draw_graphics(void) {
-    // VGA mode 13h framebuffer starts at physical address 0xA0000.
-    unsigned char *vga = (unsigned char *)0xA0000;
-    int x, y;
-    for (y = 0; y < 200; y++) {
-        for (x = 0; x < 320; x++) {
-            // Create a simple gradient based on x and y.
-            // This will cycle through colors.
-            vga[y * 320 + x] = (unsigned char)((x + y) & 0xFF);
-        }
-    }
-}
-
-void delay(void) {
-    // A simple delay loop (adjust the count for a longer delay)
-    volatile unsigned long count = 50000000;
-    while (count--) { }
+void draw_graphics(int phase) {
+    // Row y of the gradient is row 0 shifted left by y pixels, so build one
+    // 520-byte strip per frame and blit it with a source pitch of 1: each
+    // row is copied 4 bytes at a time instead of computing every pixel.
+    static unsigned char strip[320 + 200];
+    int i;
+    for (i = 0; i < 320 + 200; i++)
+        strip[i] = (unsigned char)((i + phase) & 0xFF);
+    g2d_blit(strip, 320, 200, 1, 0, 0);
 }
 
 void kmain(void) {
-    set_mode_13h();  // Switch to graphics mode
-    draw_graphics(); // Draw a color gradient
-    delay();         // Pause so you can see the graphics
-    set_mode_03h();  // Switch back to text mode
-    while (1) { }    // Halt
+    if (!vga_set_mode(0x13))  // Switch to graphics mode
+        return;
+    for (int frame = 0; frame < 180; frame++) {
+        draw_graphics(frame); // Draw the gradient, shifted each frame
+        gfx_flip();           // Show it at the next vertical retrace
+    }
+    sleep_ms(1000);           // Pause so you can see the graphics
+    vga_set_mode(0x03);       // Switch back to text mode
 }
@@ -1,9 +1,22 @@
-; bootloader.asm
-; 이 부트로더는 512바이트 부트섹터로 컴파일되어야 하며,
-; NASM을 사용해 다음과 같이 빌드할 수 있습니다:
-;   nasm -f bin bootloader.asm -o bootloader.bin
+; boot.asm
+; 이 부트로더는 512바이트 부트섹터로 컴파일되며, 디스크 2번째 섹터부터 커널
+; 이미지를 0x8000에 읽어 들인 뒤 A20을 켜고 32비트 보호 모드로 전환해
+; 커널 진입점(_start, 0x8000)으로 점프합니다.
+; 커널 섹터 수는 Makefile이 커널 크기에 맞춰 넘겨 줍니다:
+;   nasm -f bin -DKERNEL_SECTORS=<n> src/boot.asm -o boot.bin
 
 [org 0x7C00]           ; BIOS가 부트섹터를 0x7C00 주소에 로드
+[bits 16]
+
+%ifndef KERNEL_SECTORS
+%define KERNEL_SECTORS 64
+%endif
+
+KERNEL_SEGMENT   equ 0x0800    ; 0x0800:0000 = 0x8000 (커널 로드 주소)
+KERNEL_ENTRY     equ 0x8000
+SECTORS_PER_READ equ 64        ; 한 번에 32KB씩 읽음 (64KB 경계를 넘지 않도록)
+CODE_SEL         equ 0x08
+DATA_SEL         equ 0x10
 
 start:
     cli                ; 인터럽트 비활성화
@@ -12,29 +25,62 @@ start:
     mov es, ax
     mov ss, ax
     mov sp, 0x7C00     ; 스택 포인터 설정
+    sti
+
+    ; 부트 드라이브 번호를 BIOS에서 받아옴 (dl 레지스터에 있음)
+    mov [boot_drive], dl
 
     ; 부트메시지 출력
     mov si, boot_msg
     call print_string
 
-    ; 부트 드라이브 번호를 BIOS에서 받아옴 (dl 레지스터에 있음)
-    mov [boot_drive], dl
+    ; LBA 확장 읽기(INT 13h AH=42h) 지원 확인
+    mov ah, 0x41
+    mov bx, 0x55AA
+    mov dl, [boot_drive]
+    int 0x13
+    jc disk_error
+    cmp bx, 0xAA55
+    jne disk_error
 
-    ; 디스크로부터 커널(여기서는 2번째 섹터 1개)을 메모리 0x0000:0x8000에 로드
-    mov ax, 0x0000
-    mov es, ax
-    mov bx, 0x8000     ; 커널 로드 주소
-    mov ah, 0x02       ; INT 13h, 함수 02h: 디스크 읽기
-    mov al, 1          ; 읽을 섹터 수 (1개)
-    mov ch, 0          ; 실린더 0
-    mov cl, 2          ; 섹터 번호 2 (부트섹터 이후)
-    mov dh, 0          ; 헤드 0
-    mov dl, [boot_drive] ; 부트 드라이브 번호 사용
+    ; 커널을 SECTORS_PER_READ개씩 나누어 0x8000부터 차례로 읽음
+.read_loop:
+    mov ax, [sectors_left]
+    test ax, ax
+    jz .read_done
+    cmp ax, SECTORS_PER_READ
+    jbe .count_ok
+    mov ax, SECTORS_PER_READ
+.count_ok:
+    mov [dap_count], ax
+    mov si, dap
+    mov ah, 0x42
+    mov dl, [boot_drive]
     int 0x13
-    jc disk_error    ; 에러 발생 시
+    jc disk_error
+    mov ax, [dap_count]
+    sub [sectors_left], ax
+    add [dap_lba], ax
+    shl ax, 5          ; 섹터 수 * 512 / 16 = 세그먼트 증가량
+    add [dap_segment], ax
+    jmp .read_loop
+.read_done:
 
-    ; 커널 실행 (0x0000:0x8000에 로드된 커널로 점프)
-    jmp 0x0000:0x8000
+    ; A20 활성화: BIOS 호출을 먼저 시도하고, 포트 0x92(fast A20)도 설정
+    mov ax, 0x2401
+    int 0x15
+    in al, 0x92
+    or al, 2
+    and al, 0xFE       ; 비트 0은 시스템 리셋이므로 끔
+    out 0x92, al
+
+    ; 보호 모드 진입: 평면(flat) 코드/데이터 세그먼트를 가진 GDT 로드
+    cli
+    lgdt [gdt_descriptor]
+    mov eax, cr0
+    or eax, 1
+    mov cr0, eax
+    jmp CODE_SEL:pm_entry
 
 disk_error:
     mov si, err_msg
@@ -53,6 +99,40 @@ print_string:
 .done:
     ret
 
+[bits 32]
+pm_entry:
+    mov ax, DATA_SEL
+    mov ds, ax
+    mov es, ax
+    mov fs, ax
+    mov gs, ax
+    mov ss, ax
+    mov esp, 0x7C00    ; 커널이 자신의 스택으로 옮기기 전까지 사용
+    mov eax, KERNEL_ENTRY
+    jmp eax
+
+align 8
+gdt_start:
+    dq 0                        ; 널 디스크립터
+    dq 0x00CF9A000000FFFF       ; 0x08: 코드, base 0, limit 4GB, 32비트
+    dq 0x00CF92000000FFFF       ; 0x10: 데이터, base 0, limit 4GB
+gdt_end:
+
+gdt_descriptor:
+    dw gdt_end - gdt_start - 1
+    dd gdt_start
+
+; INT 13h AH=42h용 Disk Address Packet
+align 4
+dap:
+    db 0x10, 0
+dap_count   dw 0
+dap_offset  dw 0
+dap_segment dw KERNEL_SEGMENT
+dap_lba     dq 1               ; 커널은 2번째 섹터(LBA 1)부터 시작
+
+sectors_left dw KERNEL_SECTORS
+
 boot_msg db "부트로더 시작중... 커널 로딩중...", 0
 err_msg  db "디스크 읽기 오류!", 0
 boot_drive db 0
@@ -0,0 +1,696 @@
+/* fs.c - zOS in-memory file system: nodes, file data, the shell's FS
+   commands and the lookup/iteration API used by apps. The kernel links
+   it directly; tools/fs_host.c lets it run as a hosted program. */
+
+#include "fs.h"
+
+/* ------------------------------ */
+/* File System and Directory FS   */
+/* ------------------------------ */
+/* Predefined static nodes */
+Node readme_file = {
+    .name = "readme.txt",
+    .type = FILE_NODE,
+    .parent = 0,
+    .content = "This is the readme file for zOS.\n"
+};
+
+Node info_file = {
+    .name = "info.txt",
+    .type = FILE_NODE,
+    .parent = 0,
+    .content = "zOS is a minimal OS with Linux-like FS commands, ASM execution, and networking.\n"
+};
+
+Node docs_dir = {
+    .name = "docs",
+    .type = DIR_NODE,
+    .parent = 0,
+    .dir = { .children = { &info_file }, .child_count = 1 }
+};
+
+Node root = {
+    .name = "/",
+    .type = DIR_NODE,
+    .parent = 0,
+    .dir = { .children = { &readme_file, &docs_dir }, .child_count = 2 }
+};
+
+Node *current_dir = &root;
+
+/* ------------------------------- */
+/* Dynamic Node Pool for New Nodes */
+/* ------------------------------- */
+/* Removed nodes go on a free list linked through parent and are reused
+   before the pool is extended. Nodes outside the pool (the static ones
+   above, scratch nodes in the kernel) are simply dropped. */
+static Node dynamic_nodes[MAX_DYNAMIC_NODES];
+static int dynamic_node_count = 0;
+static Node *free_nodes = 0;
+static unsigned int free_node_count = 0;
+
+Node* allocate_node() {
+    alloc_count++;
+    if (free_nodes) {
+        Node *node = free_nodes;
+        free_nodes = node->parent;
+        free_node_count--;
+        memset(node, 0, sizeof(*node));
+        return node;
+    }
+    if (dynamic_node_count < MAX_DYNAMIC_NODES)
+        return &dynamic_nodes[dynamic_node_count++];
+    return 0;
+}
+
+/* Returns an unlinked node to the pool. File data must be cleared first. */
+void free_node(Node *node) {
+    if (node < dynamic_nodes || node >= dynamic_nodes + MAX_DYNAMIC_NODES)
+        return;
+    node->parent = free_nodes;
+    free_nodes = node;
+    free_node_count++;
+}
+
+unsigned int fs_nodes_in_use() {
+    return dynamic_node_count - free_node_count;
+}
+
+/* Builds the initial tree. Called again (by the hosted test driver) it
+   drops every dynamic node and starts over; the static files keep any
+   text written to them. */
+void init_fs() {
+    for (int i = 0; i < dynamic_node_count; i++) {
+        if (dynamic_nodes[i].type == FILE_NODE)
+            fs_file_clear(&dynamic_nodes[i]);
+    }
+    dynamic_node_count = 0;
+    free_nodes = 0;
+    free_node_count = 0;
+    root.dir.children[0] = &readme_file;
+    root.dir.children[1] = &docs_dir;
+    root.dir.child_count = 2;
+    docs_dir.dir.children[0] = &info_file;
+    docs_dir.dir.child_count = 1;
+    readme_file.parent = &root;
+    docs_dir.parent = &root;
+    info_file.parent = &docs_dir;
+    current_dir = &root;
+}
+
+/* ------------------------------ */
+/* File Data and Extents          */
+/* ------------------------------ */
+unsigned int content_length(const char *content) {
+    unsigned int n = 0;
+    while (n < 1023 && content[n]) n++;
+    return n;
+}
+
+/* Makes room for at least count extents. Returns 0 if out of pages. */
+int fs_extent_reserve(Node *file, unsigned int count) {
+    unsigned int cap = file->extent_pages * (PAGE_SIZE / sizeof(FileExtent));
+    if (count <= cap)
+        return 1;
+    unsigned int pages = file->extent_pages ? file->extent_pages : 1;
+    while (pages * (PAGE_SIZE / sizeof(FileExtent)) < count)
+        pages *= 2;
+    FileExtent *table = (FileExtent *)page_alloc(pages);
+    if (!table)
+        return 0;
+    for (unsigned int i = 0; i < file->extent_count; i++)
+        table[i] = file->extents[i];
+    if (file->extents)
+        page_free(file->extents, file->extent_pages);
+    file->extents = table;
+    file->extent_pages = pages;
+    return 1;
+}
+
+static int fs_extent_add(Node *file, PBuf *pb, unsigned int offset, unsigned int len) {
+    if (!fs_extent_reserve(file, file->extent_count + 1))
+        return 0;
+    FileExtent *e = &file->extents[file->extent_count++];
+    pbuf_ref(pb);
+    e->pb = pb;
+    e->offset = offset;
+    e->len = len;
+    file->extent_bytes += len;
+    return 1;
+}
+
+/* Appends the payload of every buffer in the chain to the file without
+   copying; the file takes its own reference on each buffer. */
+int fs_file_adopt(Node *file, PBuf *p) {
+    for (; p; p = p->next) {
+        if (p->len && !fs_extent_add(file, p, p->offset, p->len))
+            return 0;
+    }
+    return 1;
+}
+
+/* Appends len bytes starting off bytes into p's payload without copying. */
+int fs_file_adopt_range(Node *file, PBuf *p, unsigned int off, unsigned int len) {
+    return fs_extent_add(file, p, p->offset + off, len);
+}
+
+/* Appends len bytes by copying them into packet buffers. */
+int fs_file_write(Node *file, const void *data, unsigned int len) {
+    const unsigned char *src = (const unsigned char *)data;
+    while (len) {
+        FileExtent *last = file->extent_count ? &file->extents[file->extent_count - 1] : 0;
+        PBuf *pb;
+        unsigned int n;
+        if (last && last->pb->refcnt == 1 &&
+            last->offset + last->len == last->pb->offset + last->pb->len &&
+            pbuf_tailroom(last->pb)) {
+            /* Only this file holds the buffer: fill its tail. */
+            pb = last->pb;
+            n = pbuf_tailroom(pb);
+            if (n > len) n = len;
+            last->len += n;
+            file->extent_bytes += n;
+        } else {
+            pb = pbuf_alloc(0);
+            if (!pb)
+                return 0;
+            n = PBUF_DATA_SIZE < len ? PBUF_DATA_SIZE : len;
+            if (!fs_extent_add(file, pb, 0, n)) { pbuf_free(pb); return 0; }
+            pbuf_free(pb);  /* the extent holds the reference now */
+        }
+        memcpy(pbuf_payload(pb) + pb->len, src, n);
+        pb->len += n;
+        pb->tot_len += n;
+        src += n;
+        len -= n;
+    }
+    return 1;
+}
+
+void fs_file_clear(Node *file) {
+    for (unsigned int i = 0; i < file->extent_count; i++)
+        pbuf_free(file->extents[i].pb);
+    if (file->extents)
+        page_free(file->extents, file->extent_pages);
+    file->extents = 0;
+    file->extent_count = 0;
+    file->extent_pages = 0;
+    file->extent_bytes = 0;
+    file->content[0] = '\0';
+}
+
+unsigned int fs_file_size(Node *file) {
+    return content_length(file->content) + file->extent_bytes;
+}
+
+/* Copies up to len bytes from offset off. Returns the number copied. */
+unsigned int fs_file_read(Node *file, unsigned int off, void *buf, unsigned int len) {
+    unsigned char *out = (unsigned char *)buf;
+    unsigned int inline_len = content_length(file->content);
+    unsigned int done = 0;
+    if (off < inline_len) {
+        done = inline_len - off < len ? inline_len - off : len;
+        memcpy(out, file->content + off, done);
+        off = 0;
+    } else {
+        off -= inline_len;
+    }
+    for (unsigned int i = 0; i < file->extent_count && done < len; i++) {
+        FileExtent *e = &file->extents[i];
+        if (off >= e->len) { off -= e->len; continue; }
+        const unsigned char *src = e->pb->data + e->offset + off;
+        unsigned int n = e->len - off;
+        if (n > len - done) n = len - done;
+        memcpy(out + done, src, n);
+        done += n;
+        off = 0;
+    }
+    return done;
+}
+
+/* Makes dst a copy of src. Inline text is copied; extents are shared by
+   reference, which is safe because extent bytes are never rewritten. */
+int fs_file_copy(Node *dst, Node *src) {
+    fs_file_clear(dst);
+    strlcpy(dst->content, src->content, sizeof(dst->content));
+    if (!fs_extent_reserve(dst, src->extent_count))
+        return 0;
+    for (unsigned int i = 0; i < src->extent_count; i++)
+        fs_extent_add(dst, src->extents[i].pb, src->extents[i].offset, src->extents[i].len);
+    return 1;
+}
+
+/* Exchanges the data of two files; names and links stay put. A file can
+   be rewritten whole by filling a scratch node and swapping it in, so a
+   failed write leaves the old data intact. */
+void fs_file_swap(Node *a, Node *b) {
+    for (unsigned int i = 0; i < sizeof(a->content); i++) {
+        char c = a->content[i];
+        a->content[i] = b->content[i];
+        b->content[i] = c;
+    }
+    FileExtent *extents = a->extents;
+    unsigned int count = a->extent_count, pages = a->extent_pages, bytes = a->extent_bytes;
+    a->extents = b->extents;
+    a->extent_count = b->extent_count;
+    a->extent_pages = b->extent_pages;
+    a->extent_bytes = b->extent_bytes;
+    b->extents = extents;
+    b->extent_count = count;
+    b->extent_pages = pages;
+    b->extent_bytes = bytes;
+}
+
+void fs_file_print(Node *file) {
+    print_string(file->content);
+    for (unsigned int i = 0; i < file->extent_count; i++) {
+        const unsigned char *p = file->extents[i].pb->data + file->extents[i].offset;
+        for (unsigned int k = 0; k < file->extents[i].len; k++)
+            print_char(p[k]);
+    }
+}
+
+/* ------------------------------ */
+/* FS Command Implementations     */
+/* ------------------------------ */
+void fs_ls() {
+    TRACE(TRACE_FS_OP, FS_TRACE_LS, 0);
+    if (current_dir->type != DIR_NODE) { print_string("Current node is not a directory.\n"); return; }
+    for (int i = 0; i < current_dir->dir.child_count; i++) {
+        Node *child = current_dir->dir.children[i];
+        print_string(child->name);
+        if (child->type == DIR_NODE)
+            print_string("/");
+        print_char('\n');
+    }
+}
+
+void fs_cd(const char *dirname) {
+    TRACE(TRACE_FS_OP, FS_TRACE_CD, 0);
+    if (strcmp(dirname, "..") == 0) {
+        if (current_dir->parent != 0) current_dir = current_dir->parent;
+        else print_string("Already at root directory.\n");
+        return;
+    }
+    if (current_dir->type != DIR_NODE) { print_string("Current node is not a directory.\n"); return; }
+    for (int i = 0; i < current_dir->dir.child_count; i++) {
+        Node *child = current_dir->dir.children[i];
+        if (child->type == DIR_NODE && strcmp(child->name, dirname) == 0) {
+            current_dir = child;
+            return;
+        }
+    }
+    print_string("Directory not found: ");
+    print_string(dirname);
+    print_char('\n');
+}
+
+void fs_pwd() {
+    char *names[10];
+    int count = 0;
+    Node *temp = current_dir;
+    while (temp && count < 10) { names[count++] = temp->name; temp = temp->parent; }
+    for (int i = count - 1; i >= 0; i--) {
+        print_string(names[i]);
+        if (i > 0) print_char('/');
+    }
+    print_char('\n');
+}
+
+void fs_tree_helper(Node *node, int level) {
+    for (int i = 0; i < level; i++) print_string("  ");
+    print_string(node->name);
+    if (node->type == DIR_NODE) print_string("/");
+    print_char('\n');
+    if (node->type == DIR_NODE) {
+        for (int i = 0; i < node->dir.child_count; i++)
+            fs_tree_helper(node->dir.children[i], level + 1);
+    }
+}
+void fs_tree(Node *node, int level) {
+    TRACE(TRACE_FS_OP, FS_TRACE_TREE, 0);
+    fs_tree_helper(node, level);
+}
+
+void fs_find_recursive(Node *node, const char *name, char *prefix) {
+    if (strcmp(node->name, name) == 0) {
+        print_string(prefix);
+        print_string(node->name);
+        print_char('\n');
+    }
+    if (node->type == DIR_NODE) {
+        char new_prefix[128];
+        int i = 0;
+        while (prefix[i] != '\0' && i < 120) { new_prefix[i] = prefix[i]; i++; }
+        if (node->parent != 0) {
+            int j = 0;
+            while (node->name[j] && i < 120) { new_prefix[i++] = node->name[j++]; }
+            if (i < 120) new_prefix[i++] = '/';
+        }
+        new_prefix[i] = '\0';
+        for (int k = 0; k < node->dir.child_count; k++)
+            fs_find_recursive(node->dir.children[k], name, new_prefix);
+    }
+}
+void fs_find(Node *node, const char *name) {
+    TRACE(TRACE_FS_OP, FS_TRACE_FIND, 0);
+    char prefix[128] = "";
+    fs_find_recursive(node, name, prefix);
+}
+
+void fs_cat(const char *filename) {
+    TRACE(TRACE_FS_OP, FS_TRACE_CAT, 0);
+    if (current_dir->type != DIR_NODE) { print_string("Current node is not a directory.\n"); return; }
+    for (int i = 0; i < current_dir->dir.child_count; i++) {
+        Node *child = current_dir->dir.children[i];
+        if (child->type == FILE_NODE && strcmp(child->name, filename) == 0) {
+            fs_file_print(child);
+            return;
+        }
+    }
+    print_string("File not found: ");
+    print_string(filename);
+    print_char('\n');
+}
+
+void append_to_content(char *dest, const char *src) {
+    unsigned int i = content_length(dest);
+    i += strlcpy(dest + i, src, 1024 - i);
+    if (i < 1023) dest[i++] = '\n';
+    dest[i] = '\0';
+}
+
+void fs_edit(const char *filename) {
+    TRACE(TRACE_FS_OP, FS_TRACE_EDIT, 0);
+    if (current_dir->type != DIR_NODE) { print_string("Current node is not a directory.\n"); return; }
+    Node *target = 0;
+    for (int i = 0; i < current_dir->dir.child_count; i++) {
+        Node *child = current_dir->dir.children[i];
+        if (child->type == FILE_NODE && strcmp(child->name, filename) == 0) { target = child; break; }
+    }
+    if (!target) {
+        print_string("File not found: ");
+        print_string(filename);
+        print_char('\n');
+        return;
+    }
+    fs_file_clear(target);
+    TRACE(TRACE_CONSOLE_HOLD, 1, 0);
+    print_string("Editing ");
+    print_string(target->name);
+    print_string(" (type .save to finish):\n");
+    char line[128];
+    while (1) {
+        print_string("> ");
+        read_line(line, 128);
+        if (strcmp(line, ".save") == 0)
+            break;
+        append_to_content(target->content, line);
+    }
+    print_string("File saved.\n");
+    TRACE(TRACE_CONSOLE_HOLD, 0, 0);
+}
+
+void fs_mkdir(const char *dirname) {
+    TRACE(TRACE_FS_OP, FS_TRACE_MKDIR, 0);
+    if (current_dir->type != DIR_NODE) { print_string("Current node is not a directory.\n"); return; }
+    for (int i = 0; i < current_dir->dir.child_count; i++) {
+        if (strcmp(current_dir->dir.children[i]->name, dirname) == 0) {
+            print_string("A file or directory with that name already exists.\n");
+            return;
+        }
+    }
+    if (current_dir->dir.child_count >= MAX_DIR_CHILDREN) { print_string("Current directory is full.\n"); return; }
+    Node *newdir = allocate_node();
+    if (!newdir) { print_string("Node pool exhausted.\n"); return; }
+    strlcpy(newdir->name, dirname, sizeof(newdir->name));
+    newdir->type = DIR_NODE;
+    newdir->parent = current_dir;
+    newdir->dir.child_count = 0;
+    current_dir->dir.children[current_dir->dir.child_count++] = newdir;
+    print_string("Directory created.\n");
+}
+
+void fs_touch(const char *filename) {
+    TRACE(TRACE_FS_OP, FS_TRACE_TOUCH, 0);
+    if (current_dir->type != DIR_NODE) { print_string("Current node is not a directory.\n"); return; }
+    for (int i = 0; i < current_dir->dir.child_count; i++) {
+        if (strcmp(current_dir->dir.children[i]->name, filename) == 0) {
+            print_string("A file or directory with that name already exists.\n");
+            return;
+        }
+    }
+    if (current_dir->dir.child_count >= MAX_DIR_CHILDREN) { print_string("Current directory is full.\n"); return; }
+    Node *newfile = allocate_node();
+    if (!newfile) { print_string("Node pool exhausted.\n"); return; }
+    strlcpy(newfile->name, filename, sizeof(newfile->name));
+    newfile->type = FILE_NODE;
+    newfile->parent = current_dir;
+    newfile->content[0] = '\0';
+    current_dir->dir.children[current_dir->dir.child_count++] = newfile;
+    print_string("File created.\n");
+}
+
+void fs_rm(const char *filename) {
+    TRACE(TRACE_FS_OP, FS_TRACE_RM, 0);
+    if (current_dir->type != DIR_NODE) { print_string("Current node is not a directory.\n"); return; }
+    for (int i = 0; i < current_dir->dir.child_count; i++) {
+        Node *child = current_dir->dir.children[i];
+        if (child->type == FILE_NODE && strcmp(child->name, filename) == 0) {
+            fs_delete_file(current_dir, child);
+            print_string("File removed.\n");
+            return;
+        }
+    }
+    print_string("File not found: ");
+    print_string(filename);
+    print_char('\n');
+}
+
+void fs_rmdir(const char *dirname) {
+    TRACE(TRACE_FS_OP, FS_TRACE_RMDIR, 0);
+    if (current_dir->type != DIR_NODE) { print_string("Current node is not a directory.\n"); return; }
+    for (int i = 0; i < current_dir->dir.child_count; i++) {
+        Node *child = current_dir->dir.children[i];
+        if (child->type == DIR_NODE && strcmp(child->name, dirname) == 0) {
+            if (child->dir.child_count > 0) { print_string("Directory is not empty.\n"); return; }
+            for (int j = i; j < current_dir->dir.child_count - 1; j++)
+                current_dir->dir.children[j] = current_dir->dir.children[j+1];
+            current_dir->dir.child_count--;
+            free_node(child);
+            print_string("Directory removed.\n");
+            return;
+        }
+    }
+    print_string("Directory not found: ");
+    print_string(dirname);
+    print_char('\n');
+}
+
+void fs_cp(const char *src, const char *dest) {
+    TRACE(TRACE_FS_OP, FS_TRACE_CP, 0);
+    if (current_dir->type != DIR_NODE) { print_string("Current node is not a directory.\n"); return; }
+    Node *source = 0;
+    for (int i = 0; i < current_dir->dir.child_count; i++) {
+        Node *child = current_dir->dir.children[i];
+        if (child->type == FILE_NODE && strcmp(child->name, src) == 0) { source = child; break; }
+    }
+    if (!source) { print_string("Source file not found: "); print_string(src); print_char('\n'); return; }
+    for (int i = 0; i < current_dir->dir.child_count; i++) {
+        if (strcmp(current_dir->dir.children[i]->name, dest) == 0) { print_string("Destination already exists.\n"); return; }
+    }
+    if (current_dir->dir.child_count >= MAX_DIR_CHILDREN) { print_string("Current directory is full.\n"); return; }
+    Node *newfile = allocate_node();
+    if (!newfile) { print_string("Node pool exhausted.\n"); return; }
+    strlcpy(newfile->name, dest, sizeof(newfile->name));
+    newfile->type = FILE_NODE;
+    newfile->parent = current_dir;
+    if (!fs_file_copy(newfile, source)) {
+        fs_file_clear(newfile);
+        free_node(newfile);
+        print_string("Out of memory.\n");
+        return;
+    }
+    current_dir->dir.children[current_dir->dir.child_count++] = newfile;
+    print_string("File copied.\n");
+}
+
+void fs_mv(const char *src, const char *dest) {
+    TRACE(TRACE_FS_OP, FS_TRACE_MV, 0);
+    if (current_dir->type != DIR_NODE) { print_string("Current node is not a directory.\n"); return; }
+    Node *source = 0;
+    for (int i = 0; i < current_dir->dir.child_count; i++) {
+        if (strcmp(current_dir->dir.children[i]->name, src) == 0) { source = current_dir->dir.children[i]; break; }
+    }
+    if (!source) { print_string("Source not found: "); print_string(src); print_char('\n'); return; }
+    for (int i = 0; i < current_dir->dir.child_count; i++) {
+        if (strcmp(current_dir->dir.children[i]->name, dest) == 0) { print_string("Destination already exists.\n"); return; }
+    }
+    strlcpy(source->name, dest, sizeof(source->name));
+    print_string("Moved/Renamed successfully.\n");
+}
+
+/* ------------------------------ */
+/* Install Command Implementation */
+/* ------------------------------ */
+/* Returns /apps, creating it on first use. */
+Node *fs_apps_dir() {
+    Node *apps = 0;
+    for (int i = 0; i < root.dir.child_count; i++) {
+        Node *child = root.dir.children[i];
+        if (child->type == DIR_NODE && strcmp(child->name, "apps") == 0) { apps = child; break; }
+    }
+    if (!apps) {
+        Node *old = current_dir;
+        current_dir = &root;
+        fs_mkdir("apps");
+        current_dir = old;
+        for (int i = 0; i < root.dir.child_count; i++) {
+            Node *child = root.dir.children[i];
+            if (child->type == DIR_NODE && strcmp(child->name, "apps") == 0) { apps = child; break; }
+        }
+    }
+    if (!apps) print_string("Failed to create apps directory.\n");
+    return apps;
+}
+
+/* Returns the file called name in dir, or 0. */
+Node *fs_find_file(Node *dir, const char *name) {
+    for (int i = 0; dir && i < dir->dir.child_count; i++) {
+        Node *child = dir->dir.children[i];
+        if (child->type == FILE_NODE && strcmp(child->name, name) == 0)
+            return child;
+    }
+    return 0;
+}
+
+/* Returns the file called name in dir, creating it if needed; 0 if the
+   directory or the node pool is full. */
+Node *fs_create_file(Node *dir, const char *name) {
+    for (int i = 0; i < dir->dir.child_count; i++) {
+        Node *child = dir->dir.children[i];
+        if (child->type == FILE_NODE && strcmp(child->name, name) == 0)
+            return child;
+    }
+    if (dir->dir.child_count >= MAX_DIR_CHILDREN) { print_string("Directory is full.\n"); return 0; }
+    Node *file = allocate_node();
+    if (!file) { print_string("Node pool exhausted.\n"); return 0; }
+    strlcpy(file->name, name, sizeof(file->name));
+    file->type = FILE_NODE;
+    file->parent = dir;
+    file->content[0] = '\0';
+    dir->dir.children[dir->dir.child_count++] = file;
+    return file;
+}
+
+/* Frees file's contents and node and takes it out of dir. */
+void fs_delete_file(Node *dir, Node *file) {
+    fs_file_clear(file);
+    for (int i = 0; i < dir->dir.child_count; i++) {
+        if (dir->dir.children[i] == file) {
+            for (int j = i; j < dir->dir.child_count - 1; j++)
+                dir->dir.children[j] = dir->dir.children[j+1];
+            dir->dir.child_count--;
+            break;
+        }
+    }
+    free_node(file);
+}
+
+/* Opens name in the current directory for apps, creating it if create is
+   set. Returns 0 if it does not exist or cannot be created. */
+Node *fs_open(const char *name, int create) {
+    Node *file = fs_find_file(current_dir, name);
+    if (!file && create && current_dir->type == DIR_NODE)
+        file = fs_create_file(current_dir, name);
+    return file;
+}
+
+/* ------------------------------ */
+/* Directory Iteration            */
+/* ------------------------------ */
+/* Apps list directories through a DirIter instead of Node internals.
+   fs_readdir() copies out a batch of entries per call and fs_seekdir()
+   jumps straight to an index, so a viewer fetches only the window it
+   shows no matter how large the directory is. */
+Node *fs_cwd() {
+    return current_dir;
+}
+
+Node *fs_parent(Node *node) {
+    return node ? node->parent : 0;
+}
+
+const char *fs_name(Node *node) {
+    return node->name;
+}
+
+/* Starts iterating dir. Returns 0 if it is not a directory. */
+int fs_opendir(Node *dir, DirIter *it) {
+    if (!dir || dir->type != DIR_NODE)
+        return 0;
+    it->dir = dir;
+    it->pos = 0;
+    return 1;
+}
+
+int fs_dir_count(DirIter *it) {
+    return it->dir->dir.child_count;
+}
+
+void fs_seekdir(DirIter *it, int pos) {
+    int count = it->dir->dir.child_count;
+    it->pos = pos < 0 ? 0 : pos > count ? count : pos;
+}
+
+/* Copies up to max entries from the iterator position into out and
+   advances past them. Returns the number copied; 0 at the end. */
+int fs_readdir(DirIter *it, DirEntry *out, int max) {
+    int n = 0;
+    while (n < max && it->pos < it->dir->dir.child_count) {
+        Node *child = it->dir->dir.children[it->pos++];
+        strlcpy(out[n].name, child->name, sizeof(out[n].name));
+        out[n].is_dir = child->type == DIR_NODE;
+        out[n].size = out[n].is_dir ? 0 : fs_file_size(child);
+        out[n].node = child;
+        n++;
+    }
+    return n;
+}
+
+void fs_install(const char *filename) {
+    TRACE(TRACE_FS_OP, FS_TRACE_INSTALL, 0);
+    Node *src = 0;
+    for (int i = 0; i < current_dir->dir.child_count; i++) {
+        Node *child = current_dir->dir.children[i];
+        if (child->type == FILE_NODE && strcmp(child->name, filename) == 0) { src = child; break; }
+    }
+    if (!src) { print_string("File not found: "); print_string(filename); print_char('\n'); return; }
+    Node *apps = fs_apps_dir();
+    if (!apps) return;
+    for (int i = 0; i < apps->dir.child_count; i++) {
+        Node *child = apps->dir.children[i];
+        if (child->type == FILE_NODE && strcmp(child->name, filename) == 0) {
+            print_string("File already installed: ");
+            print_string(filename);
+            print_char('\n');
+            return;
+        }
+    }
+    if (apps->dir.child_count >= MAX_DIR_CHILDREN) { print_string("Apps directory is full.\n"); return; }
+    Node *newfile = allocate_node();
+    if (!newfile) { print_string("Node pool exhausted.\n"); return; }
+    strlcpy(newfile->name, filename, sizeof(newfile->name));
+    newfile->type = FILE_NODE;
+    newfile->parent = apps;
+    if (!fs_file_copy(newfile, src)) {
+        fs_file_clear(newfile);
+        free_node(newfile);
+        print_string("Out of memory.\n");
+        return;
+    }
+    apps->dir.children[apps->dir.child_count++] = newfile;
+    print_string("Installation complete: ");
+    print_string(filename);
+    print_char('\n');
+}
@@ -0,0 +1,110 @@
+/* fs.h - the in-memory file system (fs.c).
+   Nodes come from a fixed pool and directories hold a fixed number of
+   children. Both limits can be raised with -D for hosted scale runs
+   (tools/fs_stress.c); the kernel uses the defaults. */
+#ifndef FS_H
+#define FS_H
+
+#include "kernel.h"
+
+#ifndef MAX_DYNAMIC_NODES
+#define MAX_DYNAMIC_NODES 50
+#endif
+#ifndef MAX_DIR_CHILDREN
+#define MAX_DIR_CHILDREN 32      // /apps starts with the preinstalled apps
+#endif
+
+typedef enum { FILE_NODE, DIR_NODE } NodeType;
+
+/* A run of file bytes held in a packet buffer, so received payloads can
+   become file data without being copied. */
+typedef struct {
+    PBuf *pb;
+    unsigned short offset;   // Into pb->data
+    unsigned short len;
+} FileExtent;
+
+typedef struct Node {
+    char name[32];           // File or directory name
+    NodeType type;
+    struct Node *parent;
+    union {
+        char content[1024];  // For files (also used for ASM code)
+        struct {             // For directories
+            struct Node *children[MAX_DIR_CHILDREN];
+            int child_count;
+        } dir;
+    };
+    /* File data beyond content[]: the bytes of extents[] follow the
+       NUL-terminated inline text. The table lives in allocator pages. */
+    FileExtent *extents;
+    unsigned int extent_count;
+    unsigned int extent_pages;
+    unsigned int extent_bytes;
+} Node;
+
+typedef struct {
+    char name[32];
+    int is_dir;
+    unsigned int size;       // Bytes; 0 for directories
+    Node *node;              // Handle for fs_opendir() / fs_file_read()
+} DirEntry;
+
+typedef struct {
+    Node *dir;
+    int pos;
+} DirIter;
+
+extern Node root;
+extern Node *current_dir;
+
+/* Node pool */
+void init_fs();
+Node *allocate_node();
+void free_node(Node *node);
+unsigned int fs_nodes_in_use();
+
+/* File data */
+unsigned int content_length(const char *content);
+int fs_extent_reserve(Node *file, unsigned int count);
+int fs_file_adopt(Node *file, PBuf *p);
+int fs_file_adopt_range(Node *file, PBuf *p, unsigned int off, unsigned int len);
+int fs_file_write(Node *file, const void *data, unsigned int len);
+void fs_file_clear(Node *file);
+unsigned int fs_file_size(Node *file);
+unsigned int fs_file_read(Node *file, unsigned int off, void *buf, unsigned int len);
+int fs_file_copy(Node *dst, Node *src);
+void fs_file_swap(Node *a, Node *b);
+void fs_file_print(Node *file);
+
+/* Shell commands; they work on current_dir and report on the console. */
+void fs_ls();
+void fs_cd(const char *dirname);
+void fs_pwd();
+void fs_tree(Node *node, int level);
+void fs_find(Node *node, const char *name);
+void fs_cat(const char *filename);
+void fs_edit(const char *filename);
+void fs_mkdir(const char *dirname);
+void fs_touch(const char *filename);
+void fs_rm(const char *filename);
+void fs_rmdir(const char *dirname);
+void fs_cp(const char *src, const char *dest);
+void fs_mv(const char *src, const char *dest);
+void fs_install(const char *filename);
+
+/* Lookup and iteration for the kernel and apps */
+Node *fs_apps_dir();
+Node *fs_find_file(Node *dir, const char *name);
+Node *fs_create_file(Node *dir, const char *name);
+void fs_delete_file(Node *dir, Node *file);
+Node *fs_open(const char *name, int create);
+Node *fs_cwd();
+Node *fs_parent(Node *node);
+const char *fs_name(Node *node);
+int fs_opendir(Node *dir, DirIter *it);
+int fs_dir_count(DirIter *it);
+void fs_seekdir(DirIter *it, int pos);
+int fs_readdir(DirIter *it, DirEntry *out, int max);
+
+#endif
@@ -0,0 +1,104 @@
+/* kernel.h - kernel services shared by modules split out of kernel.c.
+   fs.c is built both into the kernel and, with tools/fs_host.c standing
+   in for everything declared here, as a hosted Linux program. */
+#ifndef KERNEL_H
+#define KERNEL_H
+
+/* --------------------- */
+/* Memory and Strings    */
+/* --------------------- */
+#if __STDC_HOSTED__
+#include <string.h>
+/* glibc may declare its own strlcpy with size_t; the shim provides ours. */
+#define strlcpy fs_host_strlcpy
+#else
+void *memcpy(void *dst, const void *src, unsigned int n);
+void *memset(void *dst, int c, unsigned int n);
+int strcmp(const char *s1, const char *s2);
+unsigned int strlen(const char *str);
+#endif
+unsigned int strlcpy(char *dst, const char *src, unsigned int size);
+
+/* --------------------- */
+/* Console               */
+/* --------------------- */
+void print_char(char c);
+void print_string(const char *str);
+void read_line(char *buffer, int max_length);
+
+/* Bumped by every node/page allocation for the per-command statistics. */
+extern unsigned int alloc_count;
+
+/* --------------------- */
+/* Event Tracing         */
+/* --------------------- */
+enum {
+    TRACE_KEY = 1,          /* arg: scancode */
+    TRACE_CMD_BEGIN,        /* arg: first 4 chars of the command */
+    TRACE_CMD_END,          /* arg: first 4 chars of the command */
+    TRACE_FS_OP,            /* arg16: FsTraceOp */
+    TRACE_CONSOLE_FLUSH,    /* arg: characters written */
+    TRACE_CONSOLE_HOLD,     /* arg16: 1 acquire, 0 release */
+    TRACE_NIC_TX,           /* arg16: 1 queued, 0 completed; arg: length */
+    TRACE_NIC_RX,           /* arg: length */
+    TRACE_TASK_SWITCH       /* arg16: 1 into app, 0 back to kernel; arg: entry */
+};
+
+enum {
+    FS_TRACE_LS = 1, FS_TRACE_CD, FS_TRACE_TREE, FS_TRACE_FIND, FS_TRACE_CAT,
+    FS_TRACE_EDIT, FS_TRACE_MKDIR, FS_TRACE_TOUCH, FS_TRACE_RM, FS_TRACE_RMDIR,
+    FS_TRACE_CP, FS_TRACE_MV, FS_TRACE_RUN, FS_TRACE_INSTALL, FS_TRACE_WRITE
+};
+
+extern volatile int trace_enabled;
+void trace_emit(unsigned short event, unsigned short arg16, unsigned int arg);
+
+#define TRACE(event, arg16, arg) \
+    do { \
+        if (__builtin_expect(trace_enabled, 0)) \
+            trace_emit((event), (arg16), (arg)); \
+    } while (0)
+
+/* --------------------- */
+/* Page Allocator        */
+/* --------------------- */
+#define PAGE_SIZE 4096
+
+void *page_alloc(unsigned int count);
+void page_free(void *addr, unsigned int count);
+
+/* --------------------- */
+/* Packet Buffers        */
+/* --------------------- */
+/* See "Packet Buffers" in kernel.c. The data area fills the buffer out to
+   PBUF_SIZE whatever the pointer size, so the hosted build keeps the
+   layout rules. */
+#define PBUF_SIZE 2048
+#define PBUF_HEADROOM 64    /* enough for Ethernet + IP + TCP headers */
+#define PBUF_DATA_SIZE ((int)(PBUF_SIZE - 12 - sizeof(void *)))
+
+typedef struct PBuf {
+    struct PBuf *next;
+    unsigned short offset;
+    unsigned short len;
+    unsigned int tot_len;
+    volatile unsigned short refcnt;
+    unsigned short reserved;
+    unsigned char data[PBUF_DATA_SIZE];
+} PBuf;
+
+typedef char pbuf_size_check[sizeof(PBuf) == PBUF_SIZE ? 1 : -1];
+
+PBuf *pbuf_alloc(unsigned int headroom);
+void pbuf_ref(PBuf *p);
+void pbuf_free(PBuf *p);
+
+static inline unsigned char *pbuf_payload(PBuf *p) {
+    return p->data + p->offset;
+}
+
+static inline unsigned int pbuf_tailroom(PBuf *p) {
+    return PBUF_DATA_SIZE - p->offset - p->len;
+}
+
+#endif
@@ -0,0 +1,102 @@
+/* fs_host.c - runs src/fs.c as a hosted Linux program.
+   Provides the kernel services declared in src/kernel.h on top of libc:
+   the console prints into a capture buffer the driver checks (and echoes
+   it to stdout when fs_host_echo is set), pages and packet buffers come
+   from malloc, and tracing is off. Allocation counters feed the memory
+   figures in tools/fs_stress.c. */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "fs_host.h"
+
+unsigned int alloc_count = 0;
+volatile int trace_enabled = 0;
+
+int fs_host_echo = 0;
+char fs_host_out[FS_HOST_OUT_SIZE];
+unsigned int fs_host_out_len = 0;
+unsigned long fs_host_pages = 0;
+unsigned long fs_host_pbufs = 0;
+
+void fs_host_clear_output(void) {
+    fs_host_out_len = 0;
+    fs_host_out[0] = '\0';
+}
+
+void print_char(char c) {
+    if (fs_host_echo)
+        putchar(c);
+    if (fs_host_out_len + 1 < FS_HOST_OUT_SIZE) {
+        fs_host_out[fs_host_out_len++] = c;
+        fs_host_out[fs_host_out_len] = '\0';
+    }
+}
+
+void print_string(const char *str) {
+    while (*str)
+        print_char(*str++);
+}
+
+/* fs_edit() is the only reader; it gets an empty file. */
+void read_line(char *buffer, int max_length) {
+    strlcpy(buffer, ".save", max_length);
+}
+
+unsigned int fs_host_strlcpy(char *dst, const char *src, unsigned int size) {
+    unsigned int n = 0;
+    if (size == 0)
+        return 0;
+    while (n + 1 < size && src[n])
+        n++;
+    memcpy(dst, src, n);
+    dst[n] = '\0';
+    return n;
+}
+
+void trace_emit(unsigned short event, unsigned short arg16, unsigned int arg) {
+    (void)event; (void)arg16; (void)arg;
+}
+
+void *page_alloc(unsigned int count) {
+    if (count == 0)
+        return 0;
+    void *p = aligned_alloc(PAGE_SIZE, (size_t)count * PAGE_SIZE);
+    if (p) {
+        fs_host_pages += count;
+        alloc_count++;
+    }
+    return p;
+}
+
+void page_free(void *addr, unsigned int count) {
+    fs_host_pages -= count;
+    free(addr);
+}
+
+PBuf *pbuf_alloc(unsigned int headroom) {
+    PBuf *p = (PBuf *)malloc(sizeof(PBuf));
+    if (!p)
+        return 0;
+    fs_host_pbufs++;
+    p->next = 0;
+    p->offset = headroom;
+    p->len = 0;
+    p->tot_len = 0;
+    p->refcnt = 1;
+    return p;
+}
+
+void pbuf_ref(PBuf *p) {
+    p->refcnt++;
+}
+
+void pbuf_free(PBuf *p) {
+    while (p) {
+        if (--p->refcnt)
+            return;
+        PBuf *next = p->next;
+        free(p);
+        fs_host_pbufs--;
+        p = next;
+    }
+}
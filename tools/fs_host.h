@@ -0,0 +1,17 @@
+/* fs_host.h - hooks into the hosted kernel shim (fs_host.c). */
+#ifndef FS_HOST_H
+#define FS_HOST_H
+
+#include "../src/fs.h"
+
+#define FS_HOST_OUT_SIZE 512
+
+extern int fs_host_echo;             // Also print console output to stdout
+extern char fs_host_out[];           // Console output since the last clear
+extern unsigned int fs_host_out_len;
+extern unsigned long fs_host_pages;  // Pages and packet buffers held now
+extern unsigned long fs_host_pbufs;
+
+void fs_host_clear_output(void);
+
+#endif
@@ -0,0 +1,484 @@
+/* fs_stress.c - random-operation test and benchmark for src/fs.c.
+
+   Replays random create/mkdir/lookup/rename/write/delete operations
+   against the FS shell commands, predicts each outcome (the exact console
+   message) from a shadow model of the tree, and periodically checks the
+   whole tree and the node pool against the model. At the end it prints
+   per-operation timings, ops/s and memory per node.
+
+       make fs-test                     sanitizer build, 1M ops
+       make fs-bench                    -O2 build, 5M ops
+       build/host/fs_stress -n 100000 -s 7 -v
+
+   Built with -DFS_FUZZ it is instead a libFuzzer target (make fs-fuzz):
+   the input bytes choose the operations. -r <file> replays such an input
+   in the normal build, e.g. a crash file the fuzzer saved.
+
+   The kernel limits (MAX_DYNAMIC_NODES nodes, MAX_DIR_CHILDREN per
+   directory) apply unless raised with -D, e.g.
+       make fs-bench FS_LIMITS="-DMAX_DYNAMIC_NODES=100000 -DMAX_DIR_CHILDREN=64"
+*/
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "fs_host.h"
+
+/* Names are drawn from a set somewhat larger than a directory, so
+   creates collide with existing names and directories fill up. */
+#define NAME_COUNT (MAX_DIR_CHILDREN + MAX_DIR_CHILDREN / 2 + 1)
+#define STATIC_NODES 4   /* /, readme.txt, docs, docs/info.txt */
+#define MODEL_NODES (MAX_DYNAMIC_NODES + STATIC_NODES)
+#define CHECK_READ 256
+
+enum { OP_TOUCH, OP_MKDIR, OP_LOOKUP, OP_RENAME, OP_WRITE, OP_RM, OP_RMDIR, OP_COUNT };
+
+static const char *op_names[OP_COUNT] = {
+    "touch", "mkdir", "lookup", "rename", "write", "rm", "rmdir"
+};
+
+/* Out of 100 */
+static const int op_weights[OP_COUNT] = { 22, 6, 30, 12, 8, 17, 5 };
+
+/* ------------------------------ */
+/* Operation Source               */
+/* ------------------------------ */
+/* Choices come from a PRNG, or from the fuzzer's input bytes. */
+typedef struct {
+    const uint8_t *data;
+    size_t size, pos;
+    uint64_t rng;
+    int done;
+} Source;
+
+static unsigned int pick(Source *src, unsigned int n) {
+    if (n <= 1)
+        return 0;
+    if (src->data) {
+        unsigned int v = 0;
+        for (unsigned int range = 1; range < n; range <<= 8) {
+            if (src->pos >= src->size) { src->done = 1; return 0; }
+            v = (v << 8) | src->data[src->pos++];
+        }
+        return v % n;
+    }
+    /* xorshift64* */
+    src->rng ^= src->rng >> 12;
+    src->rng ^= src->rng << 25;
+    src->rng ^= src->rng >> 27;
+    return (unsigned int)((src->rng * 0x2545F4914F6CDD1DULL) >> 32) % n;
+}
+
+/* ------------------------------ */
+/* Shadow Model                   */
+/* ------------------------------ */
+typedef struct {
+    char name[32];
+    int is_dir;
+    int live;
+    int parent;
+    int children[MAX_DIR_CHILDREN];
+    int child_count;
+    unsigned int size;
+    Node *node;              // The FS node this entry stands for
+} MNode;
+
+static MNode model[MODEL_NODES];
+static int model_free[MODEL_NODES];
+static int model_free_count;
+static int model_dynamic;    // Live dynamic nodes; the pool must agree
+static int dirs[MODEL_NODES];
+static int dir_count;
+
+static int model_add(int parent, const char *name, int is_dir, Node *node) {
+    int m = model_free[--model_free_count];
+    MNode *n = &model[m];
+    strlcpy(n->name, name, sizeof(n->name));
+    n->is_dir = is_dir;
+    n->live = 1;
+    n->parent = parent;
+    n->child_count = 0;
+    n->size = 0;
+    n->node = node;
+    if (parent >= 0)
+        model[parent].children[model[parent].child_count++] = m;
+    if (is_dir)
+        dirs[dir_count++] = m;
+    return m;
+}
+
+static void model_remove(int m) {
+    MNode *p = &model[model[m].parent];
+    int i = 0;
+    while (p->children[i] != m) i++;
+    for (; i < p->child_count - 1; i++)
+        p->children[i] = p->children[i + 1];
+    p->child_count--;
+    if (model[m].is_dir) {
+        for (i = 0; dirs[i] != m; i++) ;
+        dirs[i] = dirs[--dir_count];
+    }
+    model[m].live = 0;
+    model_free[model_free_count++] = m;
+    model_dynamic--;
+}
+
+static int model_find(int dir, const char *name) {
+    for (int i = 0; i < model[dir].child_count; i++) {
+        int c = model[dir].children[i];
+        if (strcmp(model[c].name, name) == 0)
+            return c;
+    }
+    return -1;
+}
+
+/* Resets the FS and builds the matching model of the built-in tree. */
+static void model_reset(void) {
+    init_fs();
+    model_free_count = 0;
+    for (int i = MODEL_NODES - 1; i >= 0; i--) {
+        model[i].live = 0;
+        model_free[model_free_count++] = i;
+    }
+    model_dynamic = 0;
+    dir_count = 0;
+    int r = model_add(-1, "/", 1, &root);
+    model_add(r, "readme.txt", 0, root.dir.children[0]);
+    int docs = model_add(r, "docs", 1, root.dir.children[1]);
+    model_add(docs, "info.txt", 0, root.dir.children[1]->dir.children[0]);
+    for (int i = 0; i < MODEL_NODES; i++) {
+        if (model[i].live && !model[i].is_dir)
+            model[i].size = fs_file_size(model[i].node);
+    }
+}
+
+/* ------------------------------ */
+/* Checks                         */
+/* ------------------------------ */
+static unsigned long op_no;
+static const char *op_desc = "";
+
+static void fail(const char *fmt, ...) {
+    va_list ap;
+    fprintf(stderr, "fs_stress: op %lu (%s): ", op_no, op_desc);
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    fputc('\n', stderr);
+    abort();
+}
+
+static void expect_output(const char *want) {
+    if (strcmp(fs_host_out, want) != 0)
+        fail("expected \"%s\", console printed \"%s\"", want, fs_host_out);
+}
+
+static int cmp_ptr(const void *a, const void *b) {
+    const Node *x = *(Node *const *)a, *y = *(Node *const *)b;
+    return x < y ? -1 : x > y;
+}
+
+/* Walks every directory the model knows and compares it entry by entry,
+   then checks that no node is used twice and the pool count matches. */
+static void check_tree(void) {
+    static Node *seen[MODEL_NODES];
+    int nseen = 0;
+    for (int k = 0; k < dir_count; k++) {
+        MNode *dm = &model[dirs[k]];
+        Node *dir = dm->node;
+        op_desc = dm->name;
+        if (dir->type != DIR_NODE)
+            fail("directory node has type %d", dir->type);
+        if (dir->dir.child_count != dm->child_count)
+            fail("%d children, model has %d", dir->dir.child_count, dm->child_count);
+        DirIter it;
+        DirEntry batch[4];
+        int got = 0;
+        if (!fs_opendir(dir, &it))
+            fail("fs_opendir failed");
+        for (int i = 0; i < dm->child_count; i++) {
+            Node *c = dir->dir.children[i];
+            MNode *cm = &model[dm->children[i]];
+            if (c != cm->node || c->parent != dir || strcmp(c->name, cm->name) != 0 ||
+                (c->type == DIR_NODE) != cm->is_dir)
+                fail("child %d is %s, model has %s", i, c->name, cm->name);
+            if (!cm->is_dir && fs_file_size(c) != cm->size)
+                fail("%s is %u bytes, model has %u", cm->name, fs_file_size(c), cm->size);
+            if (i % 4 == 0)
+                got = fs_readdir(&it, batch, 4);
+            DirEntry *e = &batch[i % 4];
+            if (i % 4 >= got || e->node != c || e->is_dir != cm->is_dir ||
+                e->size != (cm->is_dir ? 0 : cm->size) || strcmp(e->name, cm->name) != 0)
+                fail("fs_readdir entry %d does not match %s", i, cm->name);
+            seen[nseen++] = c;
+        }
+        if (fs_readdir(&it, batch, 4) != 0)
+            fail("fs_readdir returned entries past the end");
+    }
+    op_desc = "check";
+    qsort(seen, nseen, sizeof(seen[0]), cmp_ptr);
+    for (int i = 1; i < nseen; i++) {
+        if (seen[i] == seen[i - 1])
+            fail("node %s linked twice", seen[i]->name);
+    }
+    if (fs_nodes_in_use() != (unsigned int)model_dynamic)
+        fail("pool has %u nodes in use, model has %d", fs_nodes_in_use(), model_dynamic);
+}
+
+/* Resetting the FS must hand back every page and packet buffer. */
+static void check_released(void) {
+    op_desc = "reset";
+    init_fs();
+    if (fs_host_pages || fs_host_pbufs)
+        fail("%lu pages and %lu packet buffers leaked", fs_host_pages, fs_host_pbufs);
+}
+
+/* ------------------------------ */
+/* Operations                     */
+/* ------------------------------ */
+typedef struct {
+    unsigned long count[OP_COUNT];
+    unsigned long long ns[OP_COUNT];
+    unsigned long long bytes_written;
+    int peak_nodes;
+} Stats;
+
+static Stats stats;
+static unsigned char write_buf[5000];
+static unsigned char read_buf[CHECK_READ];
+
+static unsigned long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+#define TIMED(op, call) \
+    do { \
+        unsigned long long t0_ = now_ns(); \
+        call; \
+        stats.ns[op] += now_ns() - t0_; \
+        stats.count[op]++; \
+    } while (0)
+
+static void create(int d, const char *name, int is_dir, int op) {
+    MNode *dm = &model[d];
+    Node *dir = dm->node;
+    char want[96];
+    int ok = 0;
+    if (model_find(d, name) >= 0)
+        strlcpy(want, "A file or directory with that name already exists.\n", sizeof(want));
+    else if (dm->child_count >= MAX_DIR_CHILDREN)
+        strlcpy(want, "Current directory is full.\n", sizeof(want));
+    else if (model_dynamic >= MAX_DYNAMIC_NODES)
+        strlcpy(want, "Node pool exhausted.\n", sizeof(want));
+    else {
+        strlcpy(want, is_dir ? "Directory created.\n" : "File created.\n", sizeof(want));
+        ok = 1;
+    }
+    if (is_dir)
+        TIMED(op, fs_mkdir(name));
+    else
+        TIMED(op, fs_touch(name));
+    expect_output(want);
+    if (ok) {
+        Node *node = dir->dir.children[dir->dir.child_count - 1];
+        if (strcmp(node->name, name) != 0)
+            fail("new node is not the last child");
+        model_add(d, name, is_dir, node);
+        if (++model_dynamic > stats.peak_nodes)
+            stats.peak_nodes = model_dynamic;
+    }
+}
+
+static void run_op(Source *src) {
+    unsigned int w = pick(src, 100), op = 0;
+    while (w >= (unsigned int)op_weights[op]) { w -= op_weights[op]; op++; }
+    int d = dirs[pick(src, dir_count)];
+    char name[32], dest[32], want[96];
+    int ok = 0;
+    snprintf(name, sizeof(name), "n%u", pick(src, NAME_COUNT));
+    snprintf(dest, sizeof(dest), "n%u", pick(src, NAME_COUNT));
+    unsigned int sel = pick(src, 256);
+    if (src->done)
+        return;
+    op_no++;
+    op_desc = op_names[op];
+    MNode *dm = &model[d];
+    Node *dir = dm->node;
+    int hit = model_find(d, name);
+    current_dir = dir;
+    fs_host_clear_output();
+    want[0] = '\0';
+
+    switch (op) {
+    case OP_TOUCH:
+    case OP_MKDIR:
+        create(d, name, op == OP_MKDIR, op);
+        return;
+    case OP_LOOKUP: {
+        Node *got;
+        TIMED(op, got = fs_find_file(dir, name));
+        Node *exp = hit >= 0 && !model[hit].is_dir ? model[hit].node : 0;
+        if (got != exp)
+            fail("fs_find_file(%s) returned %p, model has %p", name, (void *)got, (void *)exp);
+        break;
+    }
+    case OP_RENAME:
+        if (hit < 0)
+            snprintf(want, sizeof(want), "Source not found: %s\n", name);
+        else if (model_find(d, dest) >= 0)
+            strlcpy(want, "Destination already exists.\n", sizeof(want));
+        else {
+            strlcpy(want, "Moved/Renamed successfully.\n", sizeof(want));
+            ok = 1;
+        }
+        TIMED(op, fs_mv(name, dest));
+        if (ok)
+            strlcpy(model[hit].name, dest, sizeof(model[hit].name));
+        break;
+    case OP_WRITE: {
+        /* Appends to a random file of this directory (never the built-in
+           ones, whose data would outlive a reset). */
+        int files[MAX_DIR_CHILDREN], n = 0;
+        for (int i = 0; i < dm->child_count; i++) {
+            int c = dm->children[i];
+            if (!model[c].is_dir && c >= STATIC_NODES)
+                files[n++] = c;
+        }
+        if (!n)
+            return;
+        MNode *fm = &model[files[sel % n]];
+        static const unsigned int sizes[] = { 1, 100, 2000, 5000 };
+        unsigned int len = sizes[(sel / 16) % 4];
+        for (unsigned int i = 0; i < len; i++)
+            write_buf[i] = (unsigned char)(op_no * 31 + i);
+        int ok;
+        TIMED(op, ok = fs_file_write(fm->node, write_buf, len));
+        if (!ok)
+            fail("fs_file_write of %u bytes failed", len);
+        unsigned int back = len < CHECK_READ ? len : CHECK_READ;
+        unsigned int off = fm->size + len - back;
+        if (fs_file_read(fm->node, off, read_buf, back) != back ||
+            memcmp(read_buf, write_buf + len - back, back) != 0)
+            fail("%s: bytes read back differ from the write", fm->name);
+        fm->size += len;
+        stats.bytes_written += len;
+        break;
+    }
+    case OP_RM:
+        ok = hit >= 0 && !model[hit].is_dir;
+        if (ok)
+            strlcpy(want, "File removed.\n", sizeof(want));
+        else
+            snprintf(want, sizeof(want), "File not found: %s\n", name);
+        TIMED(op, fs_rm(name));
+        if (ok)
+            model_remove(hit);
+        break;
+    case OP_RMDIR:
+        ok = hit >= 0 && model[hit].is_dir && !model[hit].child_count;
+        if (ok)
+            strlcpy(want, "Directory removed.\n", sizeof(want));
+        else if (hit >= 0 && model[hit].is_dir)
+            strlcpy(want, "Directory is not empty.\n", sizeof(want));
+        else
+            snprintf(want, sizeof(want), "Directory not found: %s\n", name);
+        TIMED(op, fs_rmdir(name));
+        if (ok)
+            model_remove(hit);
+        break;
+    }
+    expect_output(want);
+}
+
+/* Runs a fuzzer input (or a saved one), checking after every operation. */
+static void run_input(const uint8_t *data, size_t size) {
+    Source src = { data, size, 0, 0, 0 };
+    model_reset();
+    while (!src.done) {
+        run_op(&src);
+        check_tree();
+    }
+    check_released();
+}
+
+#ifdef FS_FUZZ
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    run_input(data, size);
+    return 0;
+}
+#else
+static void report(unsigned long ops, unsigned long long seed, unsigned long long wall_ns) {
+    /* clock_gettime() pairs cost about the same as the cheapest ops, so
+       their own cost is measured and taken out of the per-op figures. */
+    unsigned long long t0 = now_ns();
+    for (int i = 0; i < 100000; i++)
+        (void)now_ns();
+    double timer_ns = (double)(now_ns() - t0) / 100000;
+
+    printf("fs_stress: %lu ops, seed %llu, limits %d nodes / %d per directory\n",
+           ops, seed, MAX_DYNAMIC_NODES, MAX_DIR_CHILDREN);
+    printf("%-8s %10s %10s\n", "op", "count", "ns/op");
+    unsigned long total = 0;
+    double total_ns = 0;
+    for (int op = 0; op < OP_COUNT; op++) {
+        double ns = stats.count[op] ? (double)stats.ns[op] / stats.count[op] - timer_ns : 0;
+        if (ns < 0) ns = 0;
+        printf("%-8s %10lu %10.1f\n", op_names[op], stats.count[op], ns);
+        total += stats.count[op];
+        total_ns += ns * stats.count[op];
+    }
+    printf("FS calls: %.0f ops/s; with model checks: %.0f ops/s\n",
+           total_ns > 0 ? total / (total_ns / 1e9) : 0, ops / (wall_ns / 1e9));
+    printf("Memory: %zu bytes per node, %zu bytes reserved for the pool of %d "
+           "(peak %d in use)\n", sizeof(Node), sizeof(Node) * MAX_DYNAMIC_NODES,
+           MAX_DYNAMIC_NODES, stats.peak_nodes);
+    printf("File data: %lu pages + %lu packet buffers (%lu KB) held at exit; "
+           "%llu bytes written in total\n", fs_host_pages, fs_host_pbufs,
+           (fs_host_pages * PAGE_SIZE + fs_host_pbufs * PBUF_SIZE) / 1024, stats.bytes_written);
+}
+
+static int replay(const char *path) {
+    FILE *f = fopen(path, "rb");
+    if (!f) { perror(path); return 1; }
+    static uint8_t buf[1 << 20];
+    size_t size = fread(buf, 1, sizeof(buf), f);
+    fclose(f);
+    run_input(buf, size);
+    printf("fs_stress: %s: %lu ops OK\n", path, op_no);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    unsigned long ops = 1000000, check_every = 1000;
+    unsigned long long seed = 1;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) ops = strtoul(argv[++i], 0, 0);
+        else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) seed = strtoull(argv[++i], 0, 0);
+        else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) check_every = strtoul(argv[++i], 0, 0);
+        else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) return replay(argv[++i]);
+        else if (strcmp(argv[i], "-v") == 0) fs_host_echo = 1;
+        else {
+            fprintf(stderr, "usage: fs_stress [-n ops] [-s seed] [-c check interval] [-v]\n"
+                            "       fs_stress -r <fuzzer input>\n");
+            return 1;
+        }
+    }
+    Source src = { 0, 0, 0, seed * 0x9E3779B97F4A7C15ULL | 1, 0 };
+    model_reset();
+    unsigned long long t0 = now_ns();
+    while (op_no < ops) {
+        run_op(&src);
+        if (check_every && op_no % check_every == 0)
+            check_tree();
+    }
+    check_tree();
+    unsigned long long wall = now_ns() - t0;
+    report(ops, seed, wall);
+    check_released();
+    return 0;
+}
+#endif
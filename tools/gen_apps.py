@@ -0,0 +1,47 @@
+#!/usr/bin/env python3
+"""gen_apps.py - embed flat app binaries in the zOS kernel image.
+
+Writes a C file defining app_images[] / app_image_count from the given
+.bin files; init_apps() in src/kernel.c copies each one into /apps at boot.
+The file name without its directory is the name the app gets in /apps:
+
+    python3 tools/gen_apps.py build/apps/*.bin > build/apps_image.c
+
+Like the symbol table from gen_ksyms.py, the result is linked into the
+second kernel link pass and only adds .rodata.
+"""
+import os
+import sys
+
+
+def c_ident(name):
+    return "app_" + "".join(c if c.isalnum() else "_" for c in name)
+
+
+def main():
+    if len(sys.argv) < 2:
+        sys.stderr.write("usage: gen_apps.py <app.bin>...\n")
+        return 1
+    apps = []
+    for path in sys.argv[1:]:
+        with open(path, "rb") as f:
+            apps.append((os.path.basename(path), f.read()))
+    out = sys.stdout
+    out.write("/* Generated by tools/gen_apps.py - do not edit. */\n")
+    out.write("typedef struct {\n    const char *name;\n"
+              "    const unsigned char *data;\n    unsigned int size;\n} AppImage;\n\n")
+    for name, data in apps:
+        out.write("static const unsigned char %s[%d] = {\n" % (c_ident(name), max(len(data), 1)))
+        for i in range(0, len(data), 16):
+            out.write("    " + ", ".join("0x%02x" % b for b in data[i:i + 16]) + ",\n")
+        out.write("};\n\n")
+    out.write("const AppImage app_images[] = {\n")
+    for name, data in apps:
+        out.write('    { "%s", %s, %d },\n' % (name, c_ident(name), len(data)))
+    out.write("};\n")
+    out.write("const unsigned int app_image_count = %d;\n" % len(apps))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
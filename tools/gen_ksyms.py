@@ -0,0 +1,62 @@
+#!/usr/bin/env python3
+"""gen_ksyms.py - build the zOS kernel symbol table used by `prof report`.
+
+Reads a GNU ld map file (ld -Map=kernel.map) or `nm -n` output and writes a
+C file defining kernel_symbols[] / kernel_symbol_count, sorted by address.
+
+The kernel is linked twice:
+  1. link without the table (the weak references resolve to 0) and emit the map,
+  2. python3 tools/gen_ksyms.py kernel.map > ksyms.c, compile it and relink.
+The table only adds .rodata, which sits after .text in src/linker.ld, so the
+function addresses recorded from the first link stay valid.
+
+Linker maps only list global symbols; static functions are attributed to the
+preceding global one. Pass `nm -n kernel.elf` output instead to include them.
+"""
+import re
+import sys
+
+MAP_LINE = re.compile(r"^\s+0x([0-9a-fA-F]+)\s+([A-Za-z_.$][\w.$]*)\s*$")
+NM_LINE = re.compile(r"^([0-9a-fA-F]+)\s+([tTwW])\s+([A-Za-z_.$][\w.$]*)\s*$")
+
+
+def parse(lines):
+    syms = {}
+    in_text = False
+    for line in lines:
+        m = NM_LINE.match(line)
+        if m:
+            syms.setdefault(int(m.group(1), 16), m.group(3))
+            continue
+        # In a map file, only symbols inside the .text output section count.
+        if line.startswith("."):
+            in_text = line.split()[0] == ".text"
+            continue
+        m = MAP_LINE.match(line)
+        if in_text and m and "=" not in line:
+            syms.setdefault(int(m.group(1), 16), m.group(2))
+    return sorted((a, n) for a, n in syms.items()
+                  if n not in ("_text_start", "_text_end"))
+
+
+def main():
+    if len(sys.argv) != 2:
+        sys.stderr.write("usage: gen_ksyms.py <kernel.map | nm.txt>\n")
+        return 1
+    with open(sys.argv[1]) as f:
+        syms = parse(f)
+    out = sys.stdout
+    out.write("/* Generated by tools/gen_ksyms.py - do not edit. */\n")
+    out.write("typedef struct {\n    unsigned int addr;\n    const char *name;\n} KernelSymbol;\n\n")
+    out.write("const KernelSymbol kernel_symbols[] = {\n")
+    for addr, name in syms:
+        out.write('    { 0x%08x, "%s" },\n' % (addr, name))
+    if not syms:
+        out.write("    { 0, 0 },\n")
+    out.write("};\n")
+    out.write("const unsigned int kernel_symbol_count = %d;\n" % len(syms))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
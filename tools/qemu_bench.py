@@ -0,0 +1,149 @@
+#!/usr/bin/env python3
+"""qemu_bench.py - boot a zOS bench image headless and collect the results.
+
+`make bench-image` builds a kernel whose boot command runs `net init; bench`
+and then writes the failure count to the isa-debug-exit port. This script
+boots it, reads the BENCH lines the suite prints on COM1 (see "Benchmark
+Suite" in src/kernel.c) and prints them as a table or JSON:
+
+    python3 tools/qemu_bench.py build/bench/zos.img
+    python3 tools/qemu_bench.py --json build/bench/zos.img > bench.json
+    python3 tools/qemu_bench.py --baseline bench.json --tolerance 10 build/bench/zos.img
+
+With --baseline, cases whose ns/op grew by more than --tolerance percent are
+reported and the exit status is 2, so the script can gate CI. Absolute
+numbers depend on the host and on QEMU's TSC emulation; compare runs made on
+the same machine only.
+"""
+import argparse
+import json
+import re
+import subprocess
+import sys
+
+BEGIN = re.compile(r"BENCH-BEGIN tsc_khz=(\d+)")
+RESULT = re.compile(r"^BENCH (\S+) ([\d.]+) ([\d.]+) (\d+)\s*$")
+SKIPPED = re.compile(r"^BENCH (\S+) skipped\s*$")
+
+# isa-debug-exit turns the value v written to the port into exit status
+# (v << 1) | 1, so a guest reporting 0 failures exits with 1.
+QEMU_EXIT_OK = 1
+
+
+def qemu_command(args):
+    cmd = [args.qemu, "-drive", "format=raw,file=" + args.image,
+           "-display", "none", "-serial", "stdio", "-no-reboot",
+           "-m", args.memory,
+           "-device", "isa-debug-exit,iobase=0xf4,iosize=0x04"]
+    if args.nic:
+        cmd += ["-nic", "user,model=" + args.nic]
+    else:
+        cmd += ["-nic", "none"]
+    return cmd
+
+
+def parse(text):
+    tsc_khz = None
+    results = {}
+    done = False
+    for line in text.splitlines():
+        line = line.strip("\r")
+        m = BEGIN.search(line)
+        if m:
+            tsc_khz = int(m.group(1))
+            results = {}
+            continue
+        m = RESULT.match(line)
+        if m:
+            results[m.group(1)] = {
+                "cycles_per_op": float(m.group(2)),
+                "ns_per_op": float(m.group(3)),
+                "iters": int(m.group(4)),
+            }
+            continue
+        m = SKIPPED.match(line)
+        if m:
+            results[m.group(1)] = None
+            continue
+        if line.startswith("BENCH-END"):
+            done = True
+    return tsc_khz, results, done
+
+
+def compare(results, baseline, tolerance):
+    regressions = []
+    for name, base in sorted(baseline.items()):
+        cur = results.get(name)
+        if not base or not cur:
+            continue
+        limit = base["ns_per_op"] * (1 + tolerance / 100.0)
+        if cur["ns_per_op"] > limit:
+            regressions.append((name, base["ns_per_op"], cur["ns_per_op"]))
+    return regressions
+
+
+def main():
+    ap = argparse.ArgumentParser(description="Run the zOS bench suite under QEMU.")
+    ap.add_argument("image", help="raw disk image built by `make bench-image`")
+    ap.add_argument("--qemu", default="qemu-system-i386")
+    ap.add_argument("--memory", default="64M")
+    ap.add_argument("--nic", default="ne2k_pci",
+                    help="QEMU NIC model for nic.* cases ('' to run without one)")
+    ap.add_argument("--timeout", type=float, default=120.0, help="seconds")
+    ap.add_argument("--json", action="store_true", help="print JSON instead of a table")
+    ap.add_argument("--baseline", help="JSON from an earlier --json run to compare against")
+    ap.add_argument("--tolerance", type=float, default=10.0,
+                    help="allowed ns/op growth over the baseline, in percent")
+    ap.add_argument("--log", help="also write the raw serial output here")
+    args = ap.parse_args()
+
+    try:
+        proc = subprocess.run(qemu_command(args), stdout=subprocess.PIPE,
+                              stderr=subprocess.STDOUT, timeout=args.timeout)
+        output, status = proc.stdout, proc.returncode
+    except subprocess.TimeoutExpired as e:
+        output, status = e.stdout or b"", None
+    except FileNotFoundError:
+        sys.stderr.write("qemu_bench: %s not found\n" % args.qemu)
+        return 1
+    text = output.decode("utf-8", "replace")
+    if args.log:
+        with open(args.log, "w") as f:
+            f.write(text)
+
+    tsc_khz, results, done = parse(text)
+    if status is None:
+        sys.stderr.write("qemu_bench: timed out after %gs\n" % args.timeout)
+    elif status != QEMU_EXIT_OK:
+        sys.stderr.write("qemu_bench: guest exited with status %d\n" % status)
+    if not done:
+        sys.stderr.write("qemu_bench: no BENCH-END in serial output\n")
+        return 1
+
+    if args.json:
+        json.dump({"tsc_khz": tsc_khz, "results": results}, sys.stdout, indent=1)
+        sys.stdout.write("\n")
+    else:
+        print("tsc_khz %s" % tsc_khz)
+        print("%-22s %12s %12s %10s" % ("case", "cycles/op", "ns/op", "iters"))
+        for name, r in results.items():
+            if r is None:
+                print("%-22s %12s" % (name, "skipped"))
+            else:
+                print("%-22s %12.2f %12.2f %10d" % (name, r["cycles_per_op"],
+                                                    r["ns_per_op"], r["iters"]))
+
+    if args.baseline:
+        with open(args.baseline) as f:
+            baseline = json.load(f)["results"]
+        regressions = compare(results, baseline, args.tolerance)
+        for name, old, new in regressions:
+            sys.stderr.write("REGRESSION %s: %.2f -> %.2f ns/op (+%.1f%%)\n"
+                             % (name, old, new, (new / old - 1) * 100))
+        if regressions:
+            return 2
+    return 0 if status == QEMU_EXIT_OK else 1
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,172 @@
+#!/usr/bin/env python3
+"""trace_decode.py - decode a zOS `trace dump` captured from COM1.
+
+Capture the serial port to a file (e.g. qemu ... -serial file:com1.bin), run
+`trace dump` in the guest, then:
+
+    python3 tools/trace_decode.py com1.bin            # text timeline
+    python3 tools/trace_decode.py --json com1.bin > trace.json
+
+The JSON output is Chrome trace-event format (chrome://tracing, Perfetto).
+Other serial output around the dump is skipped. The first "ZTRC" whose header
+checks out and whose records all fit in the file is the dump; later matches,
+such as the magic turning up in trace payloads, are ignored.
+See "Trace Control and Serial Dump" in src/kernel.c for the record layout.
+"""
+import json
+import struct
+import sys
+
+MAGIC = b"ZTRC"
+
+EVENTS = {
+    1: "key", 2: "cmd_begin", 3: "cmd_end", 4: "fs_op", 5: "console_flush",
+    6: "console_hold", 7: "nic_tx", 8: "nic_rx", 9: "task_switch",
+}
+
+FS_OPS = {
+    1: "ls", 2: "cd", 3: "tree", 4: "find", 5: "cat", 6: "edit", 7: "mkdir",
+    8: "touch", 9: "rm", 10: "rmdir", 11: "cp", 12: "mv", 13: "run",
+    14: "install", 15: "write",
+}
+
+
+REC_MIN = struct.calcsize("<QHHI")
+MAX_CPUS = 256
+
+
+def parse_at(blob, pos):
+    """Decodes the dump whose magic is at pos, checking every length the
+    header records against the data actually captured."""
+    pos += 4
+    if pos + 12 > len(blob):
+        raise ValueError("truncated header")
+    version, rec_size, ncpus, tsc_khz = struct.unpack_from("<HHII", blob, pos)
+    if version != 1:
+        raise ValueError("unsupported trace format version %d" % version)
+    if rec_size < REC_MIN or not 1 <= ncpus <= MAX_CPUS:
+        raise ValueError("bad header (record size %d, %d cpus)" % (rec_size, ncpus))
+    pos += 12
+    records = []
+    for i in range(ncpus):
+        if pos + 8 > len(blob):
+            raise ValueError("truncated cpu header")
+        cpu, count = struct.unpack_from("<II", blob, pos)
+        pos += 8
+        if cpu != i:
+            raise ValueError("cpu %d where %d was expected" % (cpu, i))
+        if pos + count * rec_size > len(blob):
+            raise ValueError("cpu%d: %d records do not fit in the capture" % (cpu, count))
+        for _ in range(count):
+            tsc, event, arg16, arg = struct.unpack_from("<QHHI", blob, pos)
+            pos += rec_size
+            records.append((tsc, cpu, event, arg16, arg))
+    records.sort()
+    return tsc_khz, records
+
+
+def parse(blob):
+    pos = blob.find(MAGIC)
+    if pos < 0:
+        raise ValueError("no trace dump found")
+    first_error = None
+    while pos >= 0:
+        try:
+            return parse_at(blob, pos)
+        except ValueError as e:
+            # Console text may contain the magic ahead of the real dump.
+            first_error = first_error or e
+        pos = blob.find(MAGIC, pos + 1)
+    raise ValueError("no valid trace dump found: %s" % first_error)
+
+
+def tag(arg):
+    return struct.pack("<I", arg).rstrip(b"\0").decode("ascii", "replace")
+
+
+def describe(event, arg16, arg):
+    name = EVENTS.get(event, "event%d" % event)
+    if event == 1:
+        return name, "scancode=0x%02x" % arg
+    if event in (2, 3):
+        return name, tag(arg)
+    if event == 4:
+        return name, FS_OPS.get(arg16, str(arg16))
+    if event == 5:
+        return name, "%d chars" % arg
+    if event == 6:
+        return name, "acquire" if arg16 else "release"
+    if event == 7:
+        return name, "%s len=%d" % ("queued" if arg16 else "done", arg)
+    if event == 8:
+        return name, "len=%d" % arg
+    if event == 9:
+        return name, "%s 0x%08x" % ("enter app" if arg16 else "return", arg)
+    return name, "arg16=%d arg=%d" % (arg16, arg)
+
+
+def to_us(tsc, base, tsc_khz):
+    return (tsc - base) * 1000.0 / tsc_khz if tsc_khz else float(tsc - base)
+
+
+def print_text(tsc_khz, records):
+    if not records:
+        print("(empty trace)")
+        return
+    base = records[0][0]
+    unit = "us" if tsc_khz else "cycles"
+    open_spans = {}
+    for tsc, cpu, event, arg16, arg in records:
+        t = to_us(tsc, base, tsc_khz)
+        name, detail = describe(event, arg16, arg)
+        extra = ""
+        key = None
+        if event in (2, 3):
+            key = ("cmd", arg)
+        elif event == 6:
+            key = ("console", 0)
+        elif event == 7:
+            key = ("tx", arg)
+        if key:
+            starting = event == 2 or (event in (6, 7) and arg16 == 1)
+            if starting:
+                open_spans[key] = t
+            elif key in open_spans:
+                extra = "  (+%.1f %s)" % (t - open_spans.pop(key), unit)
+        print("%14.1f %s cpu%d %-14s %s%s" % (t, unit, cpu, name, detail, extra))
+
+
+def print_json(tsc_khz, records):
+    base = records[0][0] if records else 0
+    out = []
+    for tsc, cpu, event, arg16, arg in records:
+        name, detail = describe(event, arg16, arg)
+        ev = {"name": name, "ts": to_us(tsc, base, tsc_khz), "pid": 0,
+              "tid": cpu, "args": {"detail": detail}}
+        if event in (2, 3):
+            ev.update(name=tag(arg), ph="B" if event == 2 else "E")
+        elif event == 6:
+            ev.update(name="console", ph="B" if arg16 else "E")
+        else:
+            ev.update(ph="i", s="t")
+        out.append(ev)
+    json.dump({"traceEvents": out, "displayTimeUnit": "ns"}, sys.stdout, indent=1)
+    sys.stdout.write("\n")
+
+
+def main(argv):
+    args = [a for a in argv[1:] if a != "--json"]
+    if len(args) != 1:
+        sys.stderr.write("usage: trace_decode.py [--json] <com1 capture>\n")
+        return 1
+    with open(args[0], "rb") as f:
+        tsc_khz, records = parse(f.read())
+    if "--json" in argv:
+        print_json(tsc_khz, records)
+    else:
+        print_text(tsc_khz, records)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))